@@ -0,0 +1,344 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "bank.h"
+#include "common.h"
+#include <string.h>
+#if !defined(_WIN32)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct Bank_Heap_Storage {
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> instruments;
+};
+
+bool Bank::load(Player &player, std::vector<uint8_t> data)
+{
+    if (!player.load_bank_data(data.data(), data.size()))
+        return false;
+
+    std::shared_ptr<Bank_Heap_Storage> storage(new Bank_Heap_Storage);
+    std::vector<Player::Bank_Id> ids;
+    if (!player.get_instruments(ids, storage->instruments))
+        return false;
+    storage->data = std::move(data);
+
+    type_ = player.type();
+    ids_ = std::move(ids);
+    data_ = storage->data.data();
+    size_ = storage->data.size();
+    instruments_ = storage->instruments.data();
+    storage_size_ = storage->data.capacity() + storage->instruments.capacity();
+    storage_ = storage;
+    return true;
+}
+
+size_t Bank::memory_size() const
+{
+    return sizeof(*this) + ids_.capacity() * sizeof(Player::Bank_Id) + storage_size_;
+}
+
+//------------------------------------------------------------------------------
+// Packed format, all integers are little-endian.
+//
+//   0  magic, 16 bytes
+//  16  u32 format version
+//  20  u32 player type
+//  24  u32 instrument size
+//  28  u32 number of banks
+//  32  u32 offset of the bank file
+//  36  u32 size of the bank file
+//  40  u32 offset of the bank identifiers, 4 bytes each
+//  44  u32 offset of the instruments, 128 per bank
+//  48  u32 total size
+//  52  u32 byte order mark of the instruments
+//  56  u64 checksum of the bytes which follow the header
+//  64  end of header
+//
+// The instruments are stored as the structures of the player library, so a
+// packed bank is only valid for the same version of adljack on the same
+// platform. Load the original bank file again when it is rejected.
+
+static const char packed_magic[16] = "ADLJACK-PACKED";
+static constexpr uint32_t packed_version = 1;
+static constexpr uint32_t packed_byte_order = 0x01020304;
+static constexpr size_t packed_header_size = 64;
+static constexpr size_t packed_alignment = 16;
+
+static uint32_t get_u32le(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64le(const uint8_t *p)
+{
+    return get_u32le(p) | ((uint64_t)get_u32le(p + 4) << 32);
+}
+
+static void put_u32le(uint8_t *p, uint32_t x)
+{
+    for (unsigned i = 0; i < 4; ++i)
+        p[i] = (uint8_t)(x >> (8 * i));
+}
+
+static void put_u64le(uint8_t *p, uint64_t x)
+{
+    put_u32le(p, (uint32_t)x);
+    put_u32le(p + 4, (uint32_t)(x >> 32));
+}
+
+static uint64_t packed_checksum(const uint8_t *data, size_t size)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3u;
+    }
+    return hash;
+}
+
+static size_t packed_align(size_t offset)
+{
+    return (offset + packed_alignment - 1) & ~(packed_alignment - 1);
+}
+
+void Bank::save_packed(std::vector<uint8_t> &image) const
+{
+    unsigned bank_count = ids_.size();
+    size_t instruments_size = bank_count * 128 * instrument_size();
+
+    size_t data_offset = packed_header_size;
+    size_t ids_offset = packed_align(data_offset + size_);
+    size_t instruments_offset = packed_align(ids_offset + 4 * bank_count);
+    size_t total_size = instruments_offset + instruments_size;
+
+    image.assign(total_size, 0);
+    uint8_t *p = image.data();
+
+    memcpy(p, packed_magic, sizeof(packed_magic));
+    put_u32le(p + 16, packed_version);
+    put_u32le(p + 20, (uint32_t)type_);
+    put_u32le(p + 24, instrument_size());
+    put_u32le(p + 28, bank_count);
+    put_u32le(p + 32, data_offset);
+    put_u32le(p + 36, size_);
+    put_u32le(p + 40, ids_offset);
+    put_u32le(p + 44, instruments_offset);
+    put_u32le(p + 48, total_size);
+    memcpy(p + 52, &packed_byte_order, 4);
+
+    memcpy(p + data_offset, data_, size_);
+    for (unsigned b = 0; b < bank_count; ++b) {
+        uint8_t *id = p + ids_offset + 4 * b;
+        id[0] = ids_[b].percussive;
+        id[1] = ids_[b].msb;
+        id[2] = ids_[b].lsb;
+    }
+    memcpy(p + instruments_offset, instruments_, instruments_size);
+
+    put_u64le(p + 56, packed_checksum(p + packed_header_size, total_size - packed_header_size));
+}
+
+bool Bank::load_packed(const uint8_t *image, size_t size, std::shared_ptr<const void> storage, bool trusted)
+{
+    if (!is_packed(image, size) || size < packed_header_size)
+        return false;
+
+    const uint8_t *p = image;
+    if (get_u32le(p + 16) != packed_version)
+        return false;
+    if (memcmp(p + 52, &packed_byte_order, 4) != 0)
+        return false;
+
+    Player_Type pt = (Player_Type)get_u32le(p + 20);
+    if ((unsigned)pt >= player_type_count)
+        return false;
+    if (get_u32le(p + 24) != Player::instrument_size(pt))
+        return false;
+
+    size_t bank_count = get_u32le(p + 28);
+    size_t data_offset = get_u32le(p + 32);
+    size_t data_size = get_u32le(p + 36);
+    size_t ids_offset = get_u32le(p + 40);
+    size_t instruments_offset = get_u32le(p + 44);
+    size_t total_size = get_u32le(p + 48);
+    size_t instruments_size = bank_count * 128 * Player::instrument_size(pt);
+
+    if (total_size != size ||
+        data_offset < packed_header_size || data_offset > size || data_size > size - data_offset ||
+        ids_offset < packed_header_size || ids_offset > size || 4 * bank_count > size - ids_offset ||
+        instruments_offset < packed_header_size || instruments_offset % packed_alignment != 0 ||
+        instruments_offset > size || instruments_size > size - instruments_offset)
+        return false;
+
+    if (!trusted && get_u64le(p + 56) != packed_checksum(p + packed_header_size, size - packed_header_size))
+        return false;
+
+    std::vector<Player::Bank_Id> ids(bank_count);
+    for (size_t b = 0; b < bank_count; ++b) {
+        const uint8_t *id = p + ids_offset + 4 * b;
+        ids[b].percussive = id[0];
+        ids[b].msb = id[1];
+        ids[b].lsb = id[2];
+    }
+
+    type_ = pt;
+    ids_ = std::move(ids);
+    data_ = p + data_offset;
+    size_ = data_size;
+    instruments_ = p + instruments_offset;
+    storage_ = std::move(storage);
+    storage_size_ = size;
+    return true;
+}
+
+#if !defined(_WIN32)
+struct Bank_Mapping {
+    void *addr = MAP_FAILED;
+    size_t size = 0;
+    ~Bank_Mapping() { if (addr != MAP_FAILED) munmap(addr, size); }
+};
+#endif
+
+bool Bank::map_packed(const char *path)
+{
+#if !defined(_WIN32)
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    std::shared_ptr<Bank_Mapping> mapping(new Bank_Mapping);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX) {
+        mapping->size = st.st_size;
+        mapping->addr = mmap(nullptr, mapping->size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (mapping->addr == MAP_FAILED)
+        return false;
+    return load_packed((const uint8_t *)mapping->addr, mapping->size, mapping);
+#else
+    std::shared_ptr<std::vector<uint8_t>> image(new std::vector<uint8_t>);
+    if (!read_bank_file(path, *image))
+        return false;
+    return load_packed(image->data(), image->size(), image);
+#endif
+}
+
+//------------------------------------------------------------------------------
+bool read_bank_file(const char *path, std::vector<uint8_t> &data)
+{
+    FILE_u stream(fopen(path, "rb"));
+    if (!stream)
+        return false;
+
+    if (fseek(stream.get(), 0, SEEK_END) != 0)
+        return false;
+    long size = ftell(stream.get());
+    if (size < 0 || (unsigned long)size > bank_file_size_max)
+        return false;
+
+    data.resize(size);
+    if (fseek(stream.get(), 0, SEEK_SET) != 0 ||
+        fread(data.data(), 1, size, stream.get()) != (size_t)size)
+        return false;
+
+    return true;
+}
+
+Player_Type Bank::type_of(const uint8_t *data, size_t size)
+{
+    struct Magic { Player_Type type; const char *text; };
+    static const Magic magics[] = {
+        { Player_Type::OPL3, "WOPL3-BANK" },
+        { Player_Type::OPN2, "WOPN2-BANK" },
+        { Player_Type::OPN2, "WOPN2-B2NK" },
+    };
+    for (const Magic &magic : magics) {
+        size_t length = strlen(magic.text) + 1;
+        if (size >= length && memcmp(data, magic.text, length) == 0)
+            return magic.type;
+    }
+    if (is_packed(data, size) && size >= 24) {
+        unsigned type = get_u32le(data + 20);
+        if (type < player_type_count)
+            return (Player_Type)type;
+    }
+    return (Player_Type)-1;
+}
+
+bool Bank::is_packed(const uint8_t *data, size_t size)
+{
+    return size >= sizeof(packed_magic) &&
+        memcmp(data, packed_magic, sizeof(packed_magic)) == 0;
+}
+
+static size_t read_file_start(const char *path, uint8_t *data, size_t size)
+{
+    FILE_u stream(fopen(path, "rb"));
+    if (!stream)
+        return 0;
+    return fread(data, 1, size, stream.get());
+}
+
+Player_Type Bank::file_type(const char *path)
+{
+    uint8_t start[24];
+    size_t count = read_file_start(path, start, sizeof(start));
+    return type_of(start, count);
+}
+
+bool Bank::is_packed_file(const char *path)
+{
+    uint8_t start[sizeof(packed_magic)];
+    size_t count = read_file_start(path, start, sizeof(start));
+    return is_packed(start, count);
+}
+
+//------------------------------------------------------------------------------
+bool diff_banks(const Bank &from, const Bank &to, std::vector<Bank_Change> &changes)
+{
+    changes.clear();
+
+    Player_Type pt = from.type();
+    if (pt != to.type())
+        return false;
+
+    size_t header_size = Player::bank_header_size(pt);
+    if (from.size() < header_size || to.size() < header_size ||
+        memcmp(from.data(), to.data(), header_size) != 0)
+        return false;
+
+    unsigned bank_count = from.bank_count();
+    if (bank_count != to.bank_count())
+        return false;
+    for (unsigned b = 0; b < bank_count; ++b) {
+        const Player::Bank_Id &a = from.bank_id(b);
+        const Player::Bank_Id &z = to.bank_id(b);
+        if (a.percussive != z.percussive || a.msb != z.msb || a.lsb != z.lsb)
+            return false;
+    }
+
+    size_t size = Player::instrument_size(pt);
+    for (unsigned b = 0; b < bank_count; ++b) {
+        for (unsigned i = 0; i < 128; ++i) {
+            if (memcmp(from.instrument(b, i), to.instrument(b, i), size) != 0) {
+                Bank_Change change;
+                change.bank = b;
+                change.index = i;
+                changes.push_back(change);
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,84 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "player.h"
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+// A bank file together with the instruments it defines, as the player
+// sees them once the file is loaded. The instrument tables permit to
+// compare versions of a bank, and to apply only the parts which differ.
+//
+// A bank can be saved in packed format, which holds the bank file and the
+// instrument tables at fixed offsets. A packed bank is used in place from
+// a read-only mapping of the file, and shared by all who load it.
+class Bank {
+public:
+    Bank() {}
+    Bank(const Bank &) = delete;
+    Bank &operator=(const Bank &) = delete;
+
+    // parse a bank file image, by loading it into the given player
+    bool load(Player &player, std::vector<uint8_t> data);
+    // use a packed image in place, which `storage` keeps alive.
+    // the checksum is verified unless the image is trusted.
+    bool load_packed(const uint8_t *image, size_t size, std::shared_ptr<const void> storage, bool trusted = false);
+    // map a packed bank file
+    bool map_packed(const char *path);
+    void save_packed(std::vector<uint8_t> &image) const;
+
+    // identify the player type of a bank file by its magic number
+    static Player_Type type_of(const uint8_t *data, size_t size);
+    static Player_Type file_type(const char *path);
+    static bool is_packed(const uint8_t *data, size_t size);
+    static bool is_packed_file(const char *path);
+
+    Player_Type type() const
+        { return type_; }
+    // the bank file, in the format of the player
+    const uint8_t *data() const
+        { return data_; }
+    size_t size() const
+        { return size_; }
+    unsigned bank_count() const
+        { return ids_.size(); }
+    const Player::Bank_Id &bank_id(unsigned bank) const
+        { return ids_[bank]; }
+    size_t instrument_size() const
+        { return Player::instrument_size(type_); }
+    const uint8_t *instrument(unsigned bank, unsigned index) const
+        { return &instruments_[(bank * 128 + index) * instrument_size()]; }
+    // approximate memory usage
+    size_t memory_size() const;
+
+private:
+    Player_Type type_ = (Player_Type)-1;
+    std::vector<Player::Bank_Id> ids_;
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    const uint8_t *instruments_ = nullptr;
+    // the memory which holds the bank file and instruments
+    std::shared_ptr<const void> storage_;
+    size_t storage_size_ = 0;
+};
+
+static constexpr size_t bank_file_size_max = 16 * 1024 * 1024;
+
+bool read_bank_file(const char *path, std::vector<uint8_t> &data);
+
+// the embedded bank in parsed form, if it was packed at build time
+std::shared_ptr<const Bank> embedded_bank(Player_Type pt, unsigned index);
+
+struct Bank_Change {
+    unsigned bank = 0;
+    unsigned index = 0;
+};
+
+// compare two versions of a bank, and list the instruments which differ.
+// returns false if the banks differ otherwise, in their global settings or
+// in the set of banks they define.
+bool diff_banks(const Bank &from, const Bank &to, std::vector<Bank_Change> &changes);
@@ -0,0 +1,254 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "bank_cache.h"
+#include "bank_store.h"
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <stdio.h>
+
+struct File_Stamp {
+    uint64_t size = 0;
+    int64_t mtime_sec = 0;
+    long mtime_nsec = 0;
+};
+
+static bool operator==(const File_Stamp &a, const File_Stamp &b)
+{
+    return a.size == b.size && a.mtime_sec == b.mtime_sec && a.mtime_nsec == b.mtime_nsec;
+}
+
+static bool get_file_stamp(const char *path, File_Stamp &stamp)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return false;
+    stamp.size = st.st_size;
+    stamp.mtime_sec = st.st_mtime;
+#if defined(__linux__)
+    stamp.mtime_nsec = st.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    stamp.mtime_nsec = st.st_mtimespec.tv_nsec;
+#endif
+    return true;
+}
+
+static bool get_canonical_path(const char *path, std::string &canonical)
+{
+#if defined(_WIN32)
+    char buf[_MAX_PATH];
+    if (!_fullpath(buf, path, sizeof(buf)))
+        return false;
+    canonical.assign(buf);
+#else
+    char *buf = realpath(path, nullptr);
+    if (!buf)
+        return false;
+    canonical.assign(buf);
+    free(buf);
+#endif
+    return true;
+}
+
+struct Bank_Cache_Entry {
+    Player_Type type = (Player_Type)-1;
+    std::string path;
+    File_Stamp stamp;
+    size_t size = 0;
+    std::shared_ptr<const Bank> bank;
+    // parsed by a thread, without the lock, and not counted in the size
+    bool loading = false;
+};
+
+struct Bank_Cache::Impl
+{
+    mutable std::mutex mutex;
+    // signaled when an entry finishes loading
+    std::condition_variable loaded;
+    size_t budget = 0;
+    size_t size = 0;
+    // ordered by most recent use
+    std::list<Bank_Cache_Entry> entries;
+    // players used for parsing, each under its own lock
+    std::mutex parser_mutex[player_type_count];
+    std::unique_ptr<Player> parser[player_type_count];
+    std::shared_ptr<Bank_Store> store;
+    std::shared_ptr<const Bank> parse(Player_Type pt, const std::string &path, const File_Stamp &stamp, Bank_Store *store);
+    void evict(size_t budget);
+};
+
+Bank_Cache::Bank_Cache(size_t budget)
+    : P(new Impl)
+{
+    P->budget = budget;
+}
+
+Bank_Cache::~Bank_Cache()
+{
+}
+
+size_t Bank_Cache::budget() const
+{
+    std::lock_guard<std::mutex> lock(P->mutex);
+    return P->budget;
+}
+
+void Bank_Cache::set_budget(size_t budget)
+{
+    std::lock_guard<std::mutex> lock(P->mutex);
+    P->budget = budget;
+    P->evict(budget);
+}
+
+size_t Bank_Cache::size() const
+{
+    std::lock_guard<std::mutex> lock(P->mutex);
+    return P->size;
+}
+
+std::shared_ptr<const Bank> Bank_Cache::load(Player_Type pt, const char *path)
+{
+    std::string canonical;
+    File_Stamp stamp;
+    if (!get_canonical_path(path, canonical) || !get_file_stamp(canonical.c_str(), stamp))
+        return nullptr;
+
+    std::unique_lock<std::mutex> lock(P->mutex);
+    std::list<Bank_Cache_Entry> &entries = P->entries;
+
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->type != pt || it->path != canonical) {
+            ++it;
+            continue;
+        }
+        if (it->loading) {
+            // another thread parses the file, wait for it and look again
+            P->loaded.wait(lock);
+            it = entries.begin();
+            continue;
+        }
+        if (it->stamp == stamp) {
+            entries.splice(entries.begin(), entries, it);
+            return it->bank;
+        }
+        // outdated
+        P->size -= it->size;
+        entries.erase(it);
+        break;
+    }
+
+    // parse without the lock, the other loaders keep using the cache
+    entries.emplace_front();
+    auto entry = entries.begin();
+    entry->type = pt;
+    entry->path = canonical;
+    entry->stamp = stamp;
+    entry->loading = true;
+    std::shared_ptr<Bank_Store> store = P->store;
+
+    lock.unlock();
+    std::shared_ptr<const Bank> bank = P->parse(pt, canonical, stamp, store.get());
+    lock.lock();
+
+    if (!bank)
+        entries.erase(entry);
+    else {
+        entry->loading = false;
+        entry->size = bank->memory_size();
+        entry->bank = bank;
+        entries.splice(entries.begin(), entries, entry);
+        P->size += entry->size;
+        P->evict(P->budget);
+    }
+    P->loaded.notify_all();
+
+    return bank;
+}
+
+bool Bank_Cache::preload(const char *path)
+{
+    Player_Type pt = Bank::file_type(path);
+    if (pt == (Player_Type)-1)
+        return false;
+    return load(pt, path) != nullptr;
+}
+
+void Bank_Cache::clear()
+{
+    std::lock_guard<std::mutex> lock(P->mutex);
+    // the entries being loaded belong to their loaders
+    P->entries.remove_if([](const Bank_Cache_Entry &e) { return !e.loading; });
+    P->size = 0;
+}
+
+bool Bank_Cache::set_shared(bool shared)
+{
+    std::lock_guard<std::mutex> lock(P->mutex);
+    if (!shared)
+        P->store.reset();
+    else if (!P->store && Bank_Store::supported())
+        P->store.reset(new Bank_Store);
+    return (P->store != nullptr) == shared;
+}
+
+std::shared_ptr<const Bank> Bank_Cache::Impl::parse(Player_Type pt, const std::string &path, const File_Stamp &stamp, Bank_Store *store)
+{
+    // packed files are shared already, by their mapping
+    if (Bank::is_packed_file(path.c_str())) {
+        std::shared_ptr<Bank> bank(new Bank);
+        if (!bank->map_packed(path.c_str()) || bank->type() != pt)
+            return nullptr;
+        return bank;
+    }
+
+    std::string key;
+    if (store) {
+        char buf[128];
+        sprintf(buf, "\n%u\n%llu\n%lld.%09ld", (unsigned)pt, (unsigned long long)stamp.size,
+                (long long)stamp.mtime_sec, stamp.mtime_nsec);
+        key = path + buf;
+        if (std::shared_ptr<const Bank> bank = store->find(key))
+            return bank;
+    }
+
+    std::vector<uint8_t> data;
+    if (!read_bank_file(path.c_str(), data))
+        return nullptr;
+
+    std::shared_ptr<Bank> bank(new Bank);
+    {
+        std::lock_guard<std::mutex> lock(parser_mutex[(unsigned)pt]);
+        std::unique_ptr<Player> &player = parser[(unsigned)pt];
+        if (!player)
+            player.reset(Player::create(pt, 44100));
+        if (!player || !bank->load(*player, std::move(data)))
+            return nullptr;
+    }
+
+    if (store) {
+        if (std::shared_ptr<const Bank> shared = store->publish(key, *bank))
+            return shared;
+    }
+
+    return bank;
+}
+
+void Bank_Cache::Impl::evict(size_t budget)
+{
+    // banks still in use by players stay alive until they are replaced
+    for (auto it = entries.end(); size > budget && it != entries.begin();) {
+        --it;
+        if (it->loading)
+            continue;
+        size -= it->size;
+        it = entries.erase(it);
+    }
+}
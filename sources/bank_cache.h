@@ -0,0 +1,37 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "bank.h"
+#include <string>
+#include <memory>
+
+// A cache of parsed banks, by canonical path. An entry is valid as long as
+// the file keeps the same size and modification time. The least recently
+// used banks are dropped when the total size exceeds the memory budget.
+// It can be used from multiple threads. A file is parsed once, outside of
+// the lock, by the first thread which loads it, and the others loading the
+// same file wait for it.
+class Bank_Cache {
+public:
+    explicit Bank_Cache(size_t budget);
+    ~Bank_Cache();
+    size_t budget() const;
+    void set_budget(size_t budget);
+    // the memory used by the cached banks
+    size_t size() const;
+    // get the bank from the cache, or load it from the file
+    std::shared_ptr<const Bank> load(Player_Type pt, const char *path);
+    // load a bank of any player type, identified by its contents
+    bool preload(const char *path);
+    void clear();
+    // share the parsed banks with other processes, if supported
+    bool set_shared(bool shared);
+private:
+    struct Impl;
+    std::unique_ptr<Impl> P;
+};
+
+static constexpr size_t default_bank_cache_budget = 64 * 1024 * 1024;
@@ -0,0 +1,96 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "bank_loader.h"
+#include "bank_cache.h"
+#include "common.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <stdio.h>
+
+struct Bank_Loader::Impl
+{
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool quit = false;
+    std::deque<Bank_Load_Result> requests;
+    std::deque<Bank_Load_Result> results;
+    void run();
+    void process(Bank_Load_Result &res);
+};
+
+Bank_Loader::Bank_Loader()
+    : P(new Impl)
+{
+    P->thread = std::thread([this]() { P->run(); });
+}
+
+Bank_Loader::~Bank_Loader()
+{
+    {
+        std::lock_guard<std::mutex> lock(P->mutex);
+        P->quit = true;
+    }
+    P->cond.notify_one();
+    P->thread.join();
+}
+
+void Bank_Loader::request(Player_Type pt, const std::string &path)
+{
+    {
+        std::lock_guard<std::mutex> lock(P->mutex);
+        std::deque<Bank_Load_Result> &requests = P->requests;
+        for (auto it = requests.begin(); it != requests.end();) {
+            if (it->type == pt)
+                it = requests.erase(it);
+            else
+                ++it;
+        }
+        Bank_Load_Result req;
+        req.type = pt;
+        req.path = path;
+        requests.push_back(std::move(req));
+    }
+    P->cond.notify_one();
+}
+
+bool Bank_Loader::result(Bank_Load_Result &res)
+{
+    std::lock_guard<std::mutex> lock(P->mutex);
+    if (P->results.empty())
+        return false;
+    res = std::move(P->results.front());
+    P->results.pop_front();
+    return true;
+}
+
+void Bank_Loader::Impl::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        cond.wait(lock, [this]() { return quit || !requests.empty(); });
+        if (quit)
+            break;
+
+        Bank_Load_Result res = std::move(requests.front());
+        requests.pop_front();
+
+        lock.unlock();
+        process(res);
+        lock.lock();
+
+        results.push_back(std::move(res));
+        wakeup_interface();
+    }
+}
+
+void Bank_Loader::Impl::process(Bank_Load_Result &res)
+{
+    res.bank = ::bank_cache->load(res.type, res.path.c_str());
+    res.success = res.bank != nullptr;
+}
@@ -0,0 +1,35 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "player.h"
+#include "bank.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+struct Bank_Load_Result {
+    Player_Type type = (Player_Type)-1;
+    std::string path;
+    std::shared_ptr<const Bank> bank;
+    bool success = false;
+};
+
+// Reads and parses bank files on a worker thread, so the bank can be
+// handed to the player without file access or parse errors in between.
+// The interface is woken up when a result is available.
+class Bank_Loader {
+public:
+    Bank_Loader();
+    ~Bank_Loader();
+    // queue a request, superseding any pending one for the same player
+    void request(Player_Type pt, const std::string &path);
+    // get a finished request, if any
+    bool result(Bank_Load_Result &res);
+private:
+    struct Impl;
+    std::unique_ptr<Impl> P;
+};
@@ -0,0 +1,326 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "bank_store.h"
+#if defined(ADLJACK_HAVE_SHM_OPEN)
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <errno.h>
+namespace stc = std::chrono;
+#endif
+
+#if defined(ADLJACK_HAVE_SHM_OPEN)
+// Layout of a segment:
+//   one page of header, mapped read-write by every user
+//   the packed bank, mapped read-only by every user except the creator
+//
+// The name of a segment is derived from the key and the protocol version.
+// Increment the version on every change of the layout.
+
+static constexpr uint32_t store_version = 2;
+static constexpr size_t store_header_size = 4096;
+static const char store_magic[16] = "ADLJACK-STORE";
+static constexpr unsigned store_users_max = 64;
+
+enum Store_State : uint32_t {
+    Store_Writing,
+    Store_Ready,
+    // the last user left, and removes it
+    Store_Removed,
+};
+
+struct Store_Header {
+    char magic[16];
+    uint32_t version;
+    std::atomic<uint32_t> state;
+    // the process which creates the segment, and a number which differs from
+    // the one of the segments created before under the same name.
+    // 0 until the creator sets them.
+    std::atomic<int32_t> owner;
+    std::atomic<uint64_t> generation;
+    // the processes attached, 0 in the free slots. the slots of the
+    // processes which died without leaving are reclaimed.
+    std::atomic<int32_t> users[store_users_max];
+    uint32_t image_size;
+    uint32_t key_size;
+    char key[1];
+};
+
+static constexpr size_t store_key_max = store_header_size - offsetof(Store_Header, key);
+
+// how long to wait for a segment being written by another process
+static constexpr stc::milliseconds store_ready_timeout(500);
+
+struct Store_Segment {
+    std::string name;
+    Store_Header *header = (Store_Header *)MAP_FAILED;
+    void *image = MAP_FAILED;
+    size_t image_size = 0;
+    // the user slot of this process, or -1 if not attached
+    int slot = -1;
+    ~Store_Segment();
+};
+
+static bool process_alive(int32_t pid)
+{
+    return pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static uint64_t new_generation()
+{
+    static std::atomic<uint32_t> counter{0};
+    uint64_t time = stc::duration_cast<stc::nanoseconds>(
+        stc::system_clock::now().time_since_epoch()).count();
+    return (time ^ ((uint64_t)getpid() << 40) ^ ((uint64_t)counter.fetch_add(1) << 32)) | 1;
+}
+
+// remove the name, if it still refers to the segment of the generation,
+// and not to one created again since
+static void unlink_segment(const std::string &name, uint64_t generation)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        return;
+    struct stat st;
+    Store_Header *hdr = (Store_Header *)MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= store_header_size)
+        hdr = (Store_Header *)mmap(nullptr, store_header_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == (Store_Header *)MAP_FAILED)
+        return;
+    bool same = hdr->generation.load() == generation;
+    munmap(hdr, store_header_size);
+    if (same)
+        shm_unlink(name.c_str());
+}
+
+// whether a process is still attached, reclaiming the slots of the dead ones
+static bool segment_in_use(Store_Header *hdr)
+{
+    bool used = false;
+    for (std::atomic<int32_t> &user : hdr->users) {
+        int32_t pid = user.load();
+        if (pid == 0)
+            continue;
+        if (process_alive(pid))
+            used = true;
+        else
+            user.compare_exchange_strong(pid, 0);
+    }
+    return used;
+}
+
+// count this process in a free slot, unless the segment is being removed
+static bool join_segment(Store_Segment &seg)
+{
+    Store_Header *hdr = seg.header;
+    int32_t self = getpid();
+    for (unsigned i = 0; i < store_users_max && seg.slot == -1; ++i) {
+        int32_t pid = hdr->users[i].load();
+        if ((pid == 0 || !process_alive(pid)) && hdr->users[i].compare_exchange_strong(pid, self))
+            seg.slot = i;
+    }
+    if (seg.slot == -1)
+        return false;
+    if (hdr->state.load() != Store_Ready) {
+        hdr->users[seg.slot].store(0);
+        seg.slot = -1;
+        return false;
+    }
+    return true;
+}
+
+Store_Segment::~Store_Segment()
+{
+    if (slot != -1) {
+        header->users[slot].store(0);
+        // the last user removes it, unless one came in meanwhile
+        uint32_t ready = Store_Ready;
+        if (!segment_in_use(header) && header->state.compare_exchange_strong(ready, Store_Removed)) {
+            if (segment_in_use(header))
+                header->state.store(Store_Ready);
+            else
+                unlink_segment(name, header->generation.load());
+        }
+    }
+    if (image != MAP_FAILED)
+        munmap(image, image_size);
+    if (header != (Store_Header *)MAP_FAILED)
+        munmap(header, store_header_size);
+}
+
+static std::string segment_name(const std::string &key)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 0x100000001b3u;
+    }
+    char name[64];
+    sprintf(name, "/adljack-%u-%u-%016llx", (unsigned)getuid(), store_version, (unsigned long long)hash);
+    return name;
+}
+
+static bool attach_segment(Store_Segment &seg, int fd, bool writable_image)
+{
+    seg.header = (Store_Header *)mmap(nullptr, store_header_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (seg.header == (Store_Header *)MAP_FAILED)
+        return false;
+    int prot = writable_image ? (PROT_READ|PROT_WRITE) : PROT_READ;
+    seg.image = mmap(nullptr, seg.image_size, prot, MAP_SHARED, fd, store_header_size);
+    return seg.image != MAP_FAILED;
+}
+
+// attach the bank published under the key. a segment left in writing state
+// by a process which died is removed, and `stale` is set.
+static std::shared_ptr<const Bank> find_segment(const std::string &key, bool &stale)
+{
+    stale = false;
+
+    std::shared_ptr<Store_Segment> seg(new Store_Segment);
+    seg->name = segment_name(key);
+
+    int fd = shm_open(seg->name.c_str(), O_RDWR, 0);
+    if (fd == -1)
+        return nullptr;
+
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0 && (size_t)st.st_size > store_header_size;
+    if (valid) {
+        seg->image_size = st.st_size - store_header_size;
+        valid = attach_segment(*seg, fd, false);
+    }
+    close(fd);
+    if (!valid)
+        return nullptr;
+
+    Store_Header *hdr = seg->header;
+
+    // the creator might be writing yet, or have died doing it
+    stc::steady_clock::time_point timeout = stc::steady_clock::now() + store_ready_timeout;
+    while (hdr->state.load() == Store_Writing) {
+        int32_t owner = hdr->owner.load();
+        if (!process_alive(owner)) {
+            unlink_segment(seg->name, hdr->generation.load());
+            stale = true;
+            return nullptr;
+        }
+        if (stc::steady_clock::now() > timeout)
+            return nullptr;
+        std::this_thread::sleep_for(stc::milliseconds(1));
+    }
+
+    if (memcmp(hdr->magic, store_magic, sizeof(store_magic)) != 0 || hdr->version != store_version)
+        return nullptr;
+    if (hdr->key_size != key.size() || memcmp(hdr->key, key.data(), key.size()) != 0 ||
+        hdr->image_size > seg->image_size)
+        return nullptr;
+
+    if (!join_segment(*seg))
+        return nullptr;
+
+    std::shared_ptr<Bank> bank(new Bank);
+    if (!bank->load_packed((const uint8_t *)seg->image, hdr->image_size, seg))
+        return nullptr;
+    return bank;
+}
+#endif
+
+bool Bank_Store::supported()
+{
+#if defined(ADLJACK_HAVE_SHM_OPEN)
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::shared_ptr<const Bank> Bank_Store::find(const std::string &key)
+{
+#if defined(ADLJACK_HAVE_SHM_OPEN)
+    if (key.size() > store_key_max)
+        return nullptr;
+    bool stale;
+    return find_segment(key, stale);
+#else
+    (void)key;
+    return nullptr;
+#endif
+}
+
+std::shared_ptr<const Bank> Bank_Store::publish(const std::string &key, const Bank &bank)
+{
+#if defined(ADLJACK_HAVE_SHM_OPEN)
+    if (key.size() > store_key_max)
+        return nullptr;
+
+    std::vector<uint8_t> image;
+    bank.save_packed(image);
+
+    std::shared_ptr<Store_Segment> seg(new Store_Segment);
+    seg->name = segment_name(key);
+    seg->image_size = image.size();
+
+    int fd;
+    for (unsigned attempt = 0;; ++attempt) {
+        fd = shm_open(seg->name.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
+        if (fd != -1)
+            break;
+        if (errno != EEXIST || attempt > 0)
+            return nullptr;
+        // published concurrently by another process, or left by a dead one
+        bool stale;
+        if (std::shared_ptr<const Bank> shared = find_segment(key, stale))
+            return shared;
+        if (!stale)
+            return nullptr;
+    }
+
+    // a fresh segment is zero-filled, so it starts in writing state
+    uint64_t generation = new_generation();
+    bool valid = ftruncate(fd, store_header_size + image.size()) == 0 &&
+        attach_segment(*seg, fd, true);
+    close(fd);
+    if (!valid) {
+        // not marked with the generation yet, as nobody else removes it
+        shm_unlink(seg->name.c_str());
+        return nullptr;
+    }
+
+    Store_Header *hdr = seg->header;
+    hdr->generation.store(generation);
+    hdr->owner.store(getpid());
+    memcpy(hdr->magic, store_magic, sizeof(store_magic));
+    hdr->version = store_version;
+    hdr->image_size = image.size();
+    hdr->key_size = key.size();
+    memcpy(hdr->key, key.data(), key.size());
+    memcpy(seg->image, image.data(), image.size());
+    mprotect(seg->image, seg->image_size, PROT_READ);
+    hdr->users[0].store(getpid());
+    seg->slot = 0;
+    hdr->state.store(Store_Ready);
+
+    std::shared_ptr<Bank> shared(new Bank);
+    if (!shared->load_packed((const uint8_t *)seg->image, hdr->image_size, seg))
+        return nullptr;
+    return shared;
+#else
+    (void)key;
+    (void)bank;
+    return nullptr;
+#endif
+}
@@ -0,0 +1,25 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "bank.h"
+#include <string>
+#include <memory>
+
+// A store of parsed banks shared between processes. Each bank is kept in
+// packed format in a named shared memory segment, which other processes
+// attach read-only instead of parsing the bank again. The segment records
+// the processes which use it, and the last one to leave removes it. The
+// processes which died are forgotten, and a segment whose creator died
+// before finishing it is removed.
+class Bank_Store {
+public:
+    // whether the system supports sharing
+    static bool supported();
+    // attach the bank stored under the key, if some process published it
+    std::shared_ptr<const Bank> find(const std::string &key);
+    // store the bank under the key, and get the shared copy
+    std::shared_ptr<const Bank> publish(const std::string &key, const Bank &bank);
+};
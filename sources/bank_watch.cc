@@ -0,0 +1,149 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "bank_watch.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <time.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+struct Bank_Watcher::Impl
+{
+    std::string path;
+    time_t mtime = 0;
+#if defined(__linux__)
+    std::string dirname;
+    std::string basename;
+    int fd = -1;
+    int wd_file = -1;
+    int wd_dir = -1;
+    void add_file_watch();
+    void remove_watches();
+#endif
+};
+
+Bank_Watcher::Bank_Watcher()
+    : P(new Impl)
+{
+#if defined(__linux__)
+    P->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+#endif
+}
+
+Bank_Watcher::~Bank_Watcher()
+{
+#if defined(__linux__)
+    if (P->fd != -1)
+        close(P->fd);
+#endif
+}
+
+void Bank_Watcher::watch(const std::string &path)
+{
+    if (P->path == path)
+        return;
+
+    P->path = path;
+
+    struct stat st;
+    P->mtime = (!path.empty() && !stat(path.c_str(), &st)) ? st.st_mtime : 0;
+
+#if defined(__linux__)
+    P->remove_watches();
+    if (P->fd == -1 || path.empty())
+        return;
+
+    size_t pos = path.rfind('/');
+    if (pos == path.npos) {
+        P->dirname = ".";
+        P->basename = path;
+    }
+    else {
+        P->dirname = (pos > 0) ? path.substr(0, pos) : "/";
+        P->basename = path.substr(pos + 1);
+    }
+
+    P->wd_dir = inotify_add_watch(
+        P->fd, P->dirname.c_str(), IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE|IN_ONLYDIR);
+    P->add_file_watch();
+#endif
+}
+
+const std::string &Bank_Watcher::path() const
+{
+    return P->path;
+}
+
+int Bank_Watcher::fd() const
+{
+#if defined(__linux__)
+    return P->fd;
+#else
+    return -1;
+#endif
+}
+
+bool Bank_Watcher::check()
+{
+    if (P->path.empty())
+        return false;
+
+#if defined(__linux__)
+    if (P->fd != -1) {
+        bool changed = false;
+        alignas(inotify_event) char buf[4096];
+        ssize_t count;
+        while ((count = read(P->fd, buf, sizeof(buf))) > 0) {
+            for (const char *pos = buf; pos < buf + count;) {
+                const inotify_event *event = (const inotify_event *)pos;
+                pos += sizeof(inotify_event) + event->len;
+                if (event->wd == P->wd_dir) {
+                    if (event->len > 0 && P->basename == event->name) {
+                        // the file is replaced, follow the new one
+                        if (event->mask & (IN_MOVED_TO|IN_CREATE))
+                            P->add_file_watch();
+                        changed = true;
+                    }
+                }
+                else if (event->wd == P->wd_file) {
+                    if (event->mask & IN_IGNORED)
+                        P->wd_file = -1;
+                    else
+                        changed = true;
+                }
+            }
+        }
+        return changed;
+    }
+#endif
+
+    struct stat st;
+    time_t old_mtime = P->mtime;
+    time_t new_mtime = !stat(P->path.c_str(), &st) ? st.st_mtime : 0;
+    P->mtime = new_mtime;
+    return new_mtime && new_mtime != old_mtime;
+}
+
+#if defined(__linux__)
+void Bank_Watcher::Impl::add_file_watch()
+{
+    // also watch the file, which may be modified through another link
+    wd_file = inotify_add_watch(
+        fd, path.c_str(), IN_CLOSE_WRITE|IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF);
+}
+
+void Bank_Watcher::Impl::remove_watches()
+{
+    if (wd_file != -1)
+        inotify_rm_watch(fd, wd_file);
+    if (wd_dir != -1)
+        inotify_rm_watch(fd, wd_dir);
+    wd_file = wd_dir = -1;
+}
+#endif
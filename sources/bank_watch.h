@@ -0,0 +1,28 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <string>
+#include <memory>
+
+// Detects modifications of a bank file on disk.
+// On Linux, it watches the file and its directory with inotify, which also
+// catches the editors saving by atomic rename. Elsewhere, it compares the
+// modification times when checked.
+class Bank_Watcher {
+public:
+    Bank_Watcher();
+    ~Bank_Watcher();
+    // start watching a file, or stop if the path is empty
+    void watch(const std::string &path);
+    const std::string &path() const;
+    // a descriptor which is readable when there are events, -1 if polling
+    int fd() const;
+    // consume the pending events, and return whether the file changed
+    bool check();
+private:
+    struct Impl;
+    std::unique_ptr<Impl> P;
+};
@@ -0,0 +1,212 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "calibration.h"
+#include "common.h"
+#include "i18n.h"
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#    include <direct.h>
+#endif
+namespace stc = std::chrono;
+
+// the workload: some chips, all the channels playing chords
+static constexpr unsigned calibration_chips = 4;
+static constexpr unsigned calibration_notes = 8;
+static constexpr double calibration_duration = 1.0;
+static constexpr unsigned calibration_block = 512;
+// the share of the processing time given to the emulator
+static constexpr double calibration_safe_load = 0.7;
+
+static const char calibration_magic[] = "adljack-calibration 1";
+
+static const char *emulator_name(Player_Type pt, unsigned id)
+{
+    for (const Player::Emulator &e : Player::enumerate_emulators(pt)) {
+        if (e.id == id)
+            return e.name;
+    }
+    return nullptr;
+}
+
+static bool calibrate_emulator(Player_Type pt, unsigned emulator, unsigned sample_rate, double &ns_per_chip_frame)
+{
+    std::unique_ptr<Player> player(Player::create(pt, sample_rate));
+    if (!player || !player->set_emulator(emulator) ||
+        !player->set_chip_count(calibration_chips) || !load_default_bank(*player))
+        return false;
+
+    for (unsigned channel = 0; channel < 16; ++channel) {
+        player->rt_program_change(channel, channel * 8);
+        for (unsigned i = 0; i < calibration_notes; ++i)
+            player->rt_note_on(channel, 36 + channel + 5 * i, 100);
+    }
+
+    float buf[2 * calibration_block];
+    Player::Audio_Format format;
+    format.type = ADLMIDI_SampleType_F32;
+    format.containerSize = sizeof(float);
+    format.sampleOffset = 2 * sizeof(float);
+
+    unsigned nframes = (unsigned)(calibration_duration * sample_rate);
+    stc::steady_clock::time_point t_start = stc::steady_clock::now();
+    for (unsigned i = 0; i < nframes; i += calibration_block)
+        player->generate(calibration_block, &buf[0], &buf[1], format);
+    stc::steady_clock::duration d = stc::steady_clock::now() - t_start;
+
+    double ns = stc::duration_cast<stc::nanoseconds>(d).count();
+    ns_per_chip_frame = ns / ((double)calibration_chips * nframes);
+    return true;
+}
+
+bool calibrate_emulators(unsigned sample_rate, std::vector<Emulator_Calibration> &result)
+{
+    result.clear();
+    for (Player_Type pt : all_player_types) {
+        for (const Player::Emulator &e : Player::enumerate_emulators(pt)) {
+            Emulator_Calibration cal;
+            cal.player = pt;
+            cal.emulator = e.id;
+            // an emulator which fails is left out, the others are measured
+            if (!calibrate_emulator(pt, e.id, sample_rate, cal.ns_per_chip_frame)) {
+                debug_printf("Error measuring the emulator %s %s.", Player::name(pt), e.name);
+                continue;
+            }
+            result.push_back(cal);
+        }
+    }
+    return !result.empty();
+}
+
+std::string calibration_cache_path()
+{
+    std::string path;
+#if defined(_WIN32)
+    if (const char *dir = getenv("LOCALAPPDATA"))
+        path = dir;
+#else
+    if (const char *dir = getenv("XDG_CACHE_HOME"))
+        path = dir;
+    else if (const char *home = getenv("HOME"))
+        path = std::string(home) + "/.cache";
+#endif
+    if (path.empty())
+        return std::string();
+    return path + "/adljack/calibration";
+}
+
+bool load_calibration(unsigned sample_rate, std::vector<Emulator_Calibration> &result)
+{
+    result.clear();
+
+    std::string path = calibration_cache_path();
+    FILE_u fh;
+    if (path.empty() || !(fh.reset(fopen(path.c_str(), "r")), fh))
+        return false;
+
+    char line[256];
+    unsigned rate = 0;
+    if (!fgets(line, sizeof(line), fh.get()) ||
+        strncmp(line, calibration_magic, strlen(calibration_magic)) != 0 ||
+        fscanf(fh.get(), "%u\n", &rate) != 1 || rate != sample_rate)
+        return false;
+
+    // lines of "player <tab> emulator name <tab> time"
+    while (fgets(line, sizeof(line), fh.get())) {
+        char *player_name = line;
+        char *emulator_name = strchr(player_name, '\t');
+        char *time = emulator_name ? strchr(++emulator_name, '\t') : nullptr;
+        if (!time)
+            continue;
+        emulator_name[-1] = '\0';
+        *time++ = '\0';
+
+        Emulator_Calibration cal;
+        cal.player = Player::type_by_name(player_name);
+        if ((int)cal.player == -1)
+            continue;
+        cal.emulator = Player::emulator_by_name(cal.player, emulator_name);
+        if (cal.emulator == (unsigned)-1)
+            continue;
+        cal.ns_per_chip_frame = strtod(time, nullptr);
+        if (!(cal.ns_per_chip_frame > 0))
+            continue;
+        result.push_back(cal);
+    }
+
+    return !result.empty();
+}
+
+static bool make_directories(const std::string &path)
+{
+    for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+        std::string dir = path.substr(0, pos);
+#if defined(_WIN32)
+        int ret = _mkdir(dir.c_str());
+#else
+        int ret = mkdir(dir.c_str(), 0755);
+#endif
+        if (ret != 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+bool save_calibration(unsigned sample_rate, const std::vector<Emulator_Calibration> &calibration)
+{
+    std::string path = calibration_cache_path();
+    if (path.empty() || !make_directories(path))
+        return false;
+
+    std::string tmp_path = path + ".tmp";
+    FILE_u fh(fopen(tmp_path.c_str(), "w"));
+    if (!fh)
+        return false;
+
+    fprintf(fh.get(), "%s\n%u\n", calibration_magic, sample_rate);
+    for (const Emulator_Calibration &cal : calibration) {
+        const char *name = emulator_name(cal.player, cal.emulator);
+        if (!name)
+            continue;
+        fprintf(fh.get(), "%s\t%s\t%f\n", Player::name(cal.player), name, cal.ns_per_chip_frame);
+    }
+
+    if (fflush(fh.get()) != 0 || ferror(fh.get())) {
+        fh.reset();
+        remove(tmp_path.c_str());
+        return false;
+    }
+    fh.reset();
+
+#if defined(_WIN32)
+    remove(path.c_str());
+#endif
+    return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+void print_calibration(const std::vector<Emulator_Calibration> &calibration, unsigned sample_rate, bool quiet)
+{
+    qfprintf(quiet, stderr, _("Emulator costs at %u Hz:\n"), sample_rate);
+    for (const Emulator_Calibration &cal : calibration) {
+        const char *name = emulator_name(cal.player, cal.emulator);
+        qfprintf(quiet, stderr, _("   * %s %s: %.1f ns per chip and frame, up to %u chips\n"),
+                 Player::name(cal.player), name ? name : "?",
+                 cal.ns_per_chip_frame, max_safe_chip_count(cal, sample_rate));
+    }
+}
+
+unsigned max_safe_chip_count(const Emulator_Calibration &calibration, unsigned sample_rate)
+{
+    double frame_ns = 1e9 / sample_rate;
+    double count = calibration_safe_load * frame_ns / calibration.ns_per_chip_frame;
+    return (unsigned)std::min<double>(std::floor(count), player_max_chips);
+}
@@ -0,0 +1,32 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "player.h"
+#include <string>
+#include <vector>
+
+// The processing cost of an emulator, measured on this host.
+struct Emulator_Calibration {
+    Player_Type player = (Player_Type)-1;
+    unsigned emulator = 0;
+    // time to render one frame for each chip
+    double ns_per_chip_frame = 0;
+};
+
+// render a fixed workload through every emulator, with the given rate.
+// the emulators which fail are left out, false if none was measured.
+bool calibrate_emulators(unsigned sample_rate, std::vector<Emulator_Calibration> &result);
+
+// the calibration cache is a file under XDG_CACHE_HOME, valid for one rate.
+// an emulator is recorded by its name, for the indices may change.
+std::string calibration_cache_path();
+bool load_calibration(unsigned sample_rate, std::vector<Emulator_Calibration> &result);
+bool save_calibration(unsigned sample_rate, const std::vector<Emulator_Calibration> &calibration);
+
+void print_calibration(const std::vector<Emulator_Calibration> &calibration, unsigned sample_rate, bool quiet = false);
+
+// the number of chips which takes a safe part of the processing time
+unsigned max_safe_chip_count(const Emulator_Calibration &calibration, unsigned sample_rate);
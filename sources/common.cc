@@ -4,9 +4,17 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "common.h"
+#include "bank.h"
+#include "bank_loader.h"
+#include "bank_cache.h"
+#include "calibration.h"
+#include "render_pool.h"
 #include "tui.h"
+#include "seqlock.h"
+#include "daemon.h"
 #include "i18n.h"
 #include <algorithm>
+#include <atomic>
 #include <thread>
 #include <chrono>
 #include <stdexcept>
@@ -14,6 +22,7 @@
 #include <cmath>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #if defined(ADLJACK_HAVE_MLOCKALL)
@@ -23,11 +32,17 @@
 #    include <windows.h>
 #else
 #    include <syslog.h>
+#    include <fcntl.h>
+#    include <poll.h>
+#endif
+#if defined(__linux__)
+#    include <sys/eventfd.h>
 #endif
 namespace stc = std::chrono;
 
 std::unique_ptr<Player> player[player_type_count];
 std::string player_bank_file[player_type_count];
+std::unique_ptr<Bank_Cache> bank_cache;
 
 std::vector<Emulator_Id> emulator_ids;
 unsigned active_emulator_id = (unsigned)-1;
@@ -35,22 +50,43 @@ unsigned active_emulator_id = (unsigned)-1;
 int player_volume = 100;
 DcFilter dcfilter[2];
 VuMonitor lvmonitor[2];
-double lvcurrent[2] = {};
-double cpuratio = 0;
-Program channel_map[16];
-unsigned midi_channel_note_count[16] = {};
-std::bitset<128> midi_channel_note_active[16];
-unsigned midi_channel_last_note_p1[16] = {};
+// the state of the channels, which only the audio side uses. the other
+// threads read it from the snapshot.
+static Program channel_map[16];
+static unsigned midi_channel_note_count[16] = {};
+static std::bitset<128> midi_channel_note_active[16];
+static unsigned midi_channel_last_note_p1[16] = {};
+Channel_Controls channel_controls[16];
+Channel_Route channel_routes[16];
 static unsigned sysex_device_id = 0x10;
 static constexpr unsigned sysex_broadcast_id = 0x7f;
 
-std::unique_ptr<Ring_Buffer> fifo_notify;
+Notification_Bus notification_bus(notification_bus_capacity);
+// the messages which another thread sends to the audio side
+static std::unique_ptr<Ring_Buffer> fifo_midi_queue;
+static constexpr unsigned fifo_midi_queue_size = 1024;
 
 Player_Type arg_player_type = Player_Type::OPL3;
 unsigned arg_nchip = default_nchip;
+unsigned arg_nchip_max = 0;
 const char *arg_bankfile = nullptr;
 unsigned arg_emulator = 0;
 bool arg_autoconnect = false;
+unsigned arg_ui_fps = default_ui_fps;
+std::vector<const char *> arg_preload_banks;
+size_t arg_bank_cache_budget = default_bank_cache_budget;
+bool arg_shared_banks = false;
+unsigned arg_player_timeout = 0;
+unsigned arg_crossfade_ms = 0;
+unsigned arg_governor_high = 0;
+unsigned arg_governor_low = 0;
+bool arg_calibrate = false;
+bool arg_layer = false;
+bool arg_daemon = false;
+const char *arg_control_socket = nullptr;
+// whether to leave the choice to the calibration
+static bool arg_emulator_given = false;
+static bool arg_nchip_given = false;
 #if defined(ADLJACK_USE_CURSES)
 bool arg_simple_interface = false;
 #endif
@@ -58,6 +94,135 @@ bool arg_simple_interface = false;
 static double channels_update_delay = 50e-3;
 static unsigned channels_update_frames;
 static unsigned channels_update_left;
+// the number of consumers which want the description of the voices
+static std::atomic<unsigned> channels_update_enabled{0};
+// the value of the slot, filled on the audio side
+static Notification_Value rt_channels;
+
+// the last published snapshot, and the next one, filled on the audio side
+static Seqlock<Audio_Snapshot> audio_snapshot;
+static Audio_Snapshot rt_snapshot;
+// publish at the end of the block, without waiting for the period
+static bool rt_snapshot_due = false;
+// whether the levels of the last snapshot are cleared, while freewheeling
+static bool rt_snapshot_cleared = false;
+
+// state of the interface wakeup, on the audio side
+static bool ui_dirty = false;
+// rendering faster than real time, without measurements for the interface
+static std::atomic<bool> freewheeling{false};
+static bool ui_active = false;
+static double ui_cpuratio = 0;
+static constexpr double ui_lv_idle = 1e-3;
+static constexpr double ui_cpuratio_delta = 0.02;
+
+// the highest occupation of the voices since the last check, per mille
+static std::atomic<unsigned> voice_pressure_peak{0};
+static constexpr double chip_scaling_interval = 1.0;
+// add a chip when the voices were full, unless the processor can not
+static constexpr double chip_scaling_grow_pressure = 0.95;
+static constexpr double chip_scaling_grow_cpu = 0.75;
+// remove a chip when one less would have been mostly free, long enough
+static constexpr double chip_scaling_shrink_pressure = 0.6;
+static constexpr double chip_scaling_shrink_delay = 10.0;
+
+// the costs of the audio callbacks relative to their period, counted in
+// buckets, which the governor takes to find a percentile of the cost
+static constexpr unsigned callback_cost_buckets = 40;
+static constexpr double callback_cost_bucket_width = 0.05;
+static std::atomic<unsigned> callback_cost_histogram[callback_cost_buckets];
+static constexpr double governor_interval = 2.0;
+static constexpr double governor_percentile = 0.95;
+// the time below the low threshold before undoing a degradation
+static constexpr double governor_restore_delay = 10.0;
+// the fade of the emulator changes, short since both players render
+static constexpr unsigned governor_crossfade_ms = 20;
+
+enum Governor_Step_Kind {
+    Governor_Emulator,
+    Governor_Chips,
+    Governor_Soft_Pan,
+};
+struct Governor_Step {
+    Governor_Step_Kind kind;
+    // the setting before the step
+    unsigned previous;
+};
+static std::vector<Governor_Step> governor_steps;
+static bool soft_pan_enabled = true;
+
+// the events of the block, which the players receive before rendering it.
+// they stay for a later block if a player is locked. at the maximum, they
+// are given to the players at once, and if they are locked yet, only the
+// events which release the notes are kept, in the reserve.
+static constexpr unsigned block_event_max = 1024;
+static constexpr unsigned block_event_reserve = 64;
+static Player::Event block_events[block_event_max + block_event_reserve];
+static unsigned block_event_count = 0;
+
+// in layer mode, the players which render in parallel.
+// with multiple outputs, each is a shard playing a group of channels.
+struct Layer_Job {
+    Player *player = nullptr;
+    // the channels it receives, and the gain of its output
+    bool channel_routed[16] = {};
+    float gain = 1;
+    float *left = nullptr;
+    float *right = nullptr;
+    unsigned stride = 0;
+    unsigned nframes = 0;
+    bool dispatch = false;
+    bool rendered = false;
+};
+static constexpr unsigned layer_buffer_frames = 1024;
+static constexpr unsigned layer_max = 16;
+static Layer_Job layer_jobs[layer_max];
+static unsigned layer_count = 0;
+static bool shard_mode = false;
+static std::vector<std::unique_ptr<Player>> shard_players;
+static std::unique_ptr<DcFilter[]> shard_dcfilter;
+static std::unique_ptr<VuMonitor[]> shard_lvmonitor;
+static std::unique_ptr<float[]> layer_buffer;
+static std::unique_ptr<Render_Pool> render_pool;
+
+static unsigned player_sample_rate = 0;
+static stc::steady_clock::time_point player_inactive_since[player_type_count];
+
+// a player taking over from the active one
+enum Player_Switch_State {
+    Switch_Idle,
+    // prepared by the interface, not yet seen by the audio
+    Switch_Pending,
+    // both players play, the audio sends events to both
+    Switch_Fading,
+    // the fade is complete, in a block which still used the old player
+    Switch_Faded,
+    // the new player plays alone, the audio does not use the old one
+    // anymore, which the interface deletes
+    Switch_Finished,
+    // the new player is the active one, the audio returns to idle
+    Switch_Installed,
+};
+struct Player_Switch {
+    // the interface owns the incoming player, the audio uses the pointers.
+    // the interface sets them in idle state only, and the audio reads them
+    // in the other states, after the acquire load of the state.
+    std::unique_ptr<Player> owned;
+    Player *incoming = nullptr;
+    Player *outgoing = nullptr;
+    unsigned emulator_index = 0;
+    unsigned fade_frames = 0;
+    unsigned fade_position = 0;
+};
+static std::atomic<int> player_switch_state{Switch_Idle};
+static Player_Switch player_switch;
+static constexpr unsigned player_switch_chunk = 256;
+// hides the attack of the notes which the new player plays again
+static constexpr unsigned chip_count_crossfade_ms = 10;
+
+static int ui_wakeup_fd[2] = {-1, -1};
+static std::atomic<bool> ui_wakeup_pending{false};
+static void setup_interface_wakeup();
 
 void generic_usage(const char *progname, const char *more_options)
 {
@@ -66,6 +231,8 @@ void generic_usage(const char *progname, const char *more_options)
 #if defined(ADLJACK_USE_CURSES)
     usage_string += " [-t]";
 #endif
+    usage_string += " [-f ui-fps] [-B preload-bank]... [-m bank-cache-MiB] [-S] [-i player-timeout] [-x crossfade-ms]";
+    usage_string += " [-g cpu-high[:cpu-low]] [-C] [-l channels=player[*gain],...] [-d] [-s control-socket]";
     usage_string += "%s\n";
 
     fprintf(stderr, usage_string.c_str(), progname, more_options);
@@ -76,7 +243,7 @@ void generic_usage(const char *progname, const char *more_options)
     }
 
     for (Player_Type pt : all_player_types) {
-        std::vector<Player::Emulator> emus = Player::enumerate_emulators(pt);
+        const std::vector<Player::Emulator> &emus = Player::enumerate_emulators(pt);
         size_t emu_count = emus.size();
         fprintf(stderr, _("Available emulators for %s:\n"), Player::name(pt));
         for (size_t i = 0; i < emu_count; ++i)
@@ -84,9 +251,64 @@ void generic_usage(const char *progname, const char *more_options)
     }
 }
 
+// add the routes of the form "1-8=ADLMIDI,9=OPNMIDI*0.5", with channels
+// numbered from 1. a channel may be routed to both players. the gain is
+// that of the output of the player, the same on all of its channels.
+static bool parse_channel_routes(const char *text)
+{
+    std::string spec(text);
+    for (size_t pos = 0; pos < spec.size();) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string entry = spec.substr(pos, end - pos);
+        pos = end + 1;
+
+        unsigned first, last;
+        char name[32];
+        int namelen = 0;
+        if (sscanf(entry.c_str(), "%u-%u=%31[^*]%n", &first, &last, name, &namelen) != 3) {
+            if (sscanf(entry.c_str(), "%u=%31[^*]%n", &first, name, &namelen) != 2)
+                return false;
+            last = first;
+        }
+        if (first < 1 || last > 16 || first > last)
+            return false;
+
+        Player_Type pt = Player::type_by_name(name);
+        if ((int)pt == -1)
+            return false;
+
+        double gain = 1;
+        const char *rest = entry.c_str() + namelen;
+        if (*rest == '*') {
+            char *endp;
+            gain = strtod(rest + 1, &endp);
+            if (*endp != '\0' || !(gain > 0))
+                return false;
+        }
+        else if (*rest != '\0')
+            return false;
+
+        for (unsigned channel = first - 1; channel < last; ++channel)
+            channel_routes[channel].gain[(unsigned)pt] = gain;
+    }
+
+    for (Player_Type pt : all_player_types) {
+        float gain = 0;
+        for (const Channel_Route &route : channel_routes) {
+            float g = route.gain[(unsigned)pt];
+            if (g != 0 && gain != 0 && g != gain)
+                return false;
+            gain = (g != 0) ? g : gain;
+        }
+    }
+    return true;
+}
+
 int generic_getopt(int argc, char *argv[], const char *more_options, void(&usagefn)())
 {
-    const char *basic_optstr = "hp:n:b:e:v:a"
+    const char *basic_optstr = "hp:n:b:e:v:af:B:m:Si:x:g:Cl:ds:"
 #if defined(ADLJACK_USE_CURSES)
         "t"
 #endif
@@ -103,18 +325,25 @@ int generic_getopt(int argc, char *argv[], const char *more_options, void(&usage
                 exit(1);
             }
             break;
-        case 'n':
+        case 'n': {
+            // a count, or a range "min:max" for automatic scaling
+            const char *range = strchr(optarg, ':');
             arg_nchip = std::stoi(optarg);
-            if ((int)arg_nchip < 1) {
+            arg_nchip_max = range ? std::stoi(range + 1) : 0;
+            arg_nchip_given = true;
+            if ((int)arg_nchip < 1 || (range && (arg_nchip_max < arg_nchip ||
+                                                 arg_nchip_max > player_max_chips))) {
                 fprintf(stderr, "%s\n", _("Invalid number of chips."));
                 exit(1);
             }
             break;
+        }
         case 'b':
             arg_bankfile = optarg;
             break;
         case 'e':
             arg_emulator = std::stoi(optarg);
+            arg_emulator_given = true;
             break;
         case 'a':
             arg_autoconnect = true;
@@ -126,6 +355,70 @@ int generic_getopt(int argc, char *argv[], const char *more_options, void(&usage
                 exit(1);
             }
             break;
+        case 'f':
+            arg_ui_fps = std::stoi(optarg);
+            if ((int)arg_ui_fps < 1) {
+                fprintf(stderr, "%s\n", _("Invalid interface frame rate."));
+                exit(1);
+            }
+            break;
+        case 'B':
+            arg_preload_banks.push_back(optarg);
+            break;
+        case 'm': {
+            int mib = std::stoi(optarg);
+            if (mib < 0) {
+                fprintf(stderr, "%s\n", _("Invalid bank cache size."));
+                exit(1);
+            }
+            arg_bank_cache_budget = (size_t)mib * 1024 * 1024;
+            break;
+        }
+        case 'S':
+            arg_shared_banks = true;
+            break;
+        case 'i':
+            arg_player_timeout = std::stoi(optarg);
+            if ((int)arg_player_timeout < 0) {
+                fprintf(stderr, "%s\n", _("Invalid player timeout."));
+                exit(1);
+            }
+            break;
+        case 'x':
+            arg_crossfade_ms = std::stoi(optarg);
+            if ((int)arg_crossfade_ms < 0) {
+                fprintf(stderr, "%s\n", _("Invalid crossfade duration."));
+                exit(1);
+            }
+            break;
+        case 'g': {
+            // percents of the period, the low one defaults to 60% of the high
+            const char *low = strchr(optarg, ':');
+            arg_governor_high = std::stoi(optarg);
+            arg_governor_low = low ? std::stoi(low + 1) : arg_governor_high * 6 / 10;
+            if ((int)arg_governor_high < 1 || (int)arg_governor_low < 0 ||
+                arg_governor_low >= arg_governor_high) {
+                fprintf(stderr, "%s\n", _("Invalid processor load thresholds."));
+                exit(1);
+            }
+            break;
+        }
+        case 'C':
+            arg_calibrate = true;
+            break;
+        case 'l':
+            if (!parse_channel_routes(optarg)) {
+                fprintf(stderr, "%s\n", _("Invalid channel routes."));
+                exit(1);
+            }
+            arg_layer = true;
+            break;
+        case 'd':
+            arg_daemon = true;
+            break;
+        case 's':
+            arg_control_socket = optarg;
+            break;
         case 'h':
             usagefn();
             exit(0);
@@ -142,7 +435,131 @@ int generic_getopt(int argc, char *argv[], const char *more_options, void(&usage
     return -1;
 }
 
-bool initialize_player(Player_Type pt, unsigned sample_rate, unsigned nchip, const char *bankfile, unsigned emulator, bool quiet)
+static unsigned emulator_cost(const Emulator_Id &id)
+{
+    for (const Player::Emulator &e : Player::enumerate_emulators(id.player)) {
+        if (e.id == id.emulator)
+            return e.cost;
+    }
+    return 0;
+}
+
+// choose the most accurate emulator which plays the chips in time, taking
+// the costly ones as the accurate ones. without enough, reduce the chips.
+static void preselect_emulator(Player_Type pt, unsigned sample_rate, const std::vector<Emulator_Calibration> &calibration, unsigned &emulator, unsigned &nchip)
+{
+    const Emulator_Calibration *best = nullptr;
+    unsigned best_cost = 0;
+    const Emulator_Calibration *fastest = nullptr;
+
+    for (const Emulator_Calibration &cal : calibration) {
+        if (cal.player != pt)
+            continue;
+        if (!fastest || cal.ns_per_chip_frame < fastest->ns_per_chip_frame)
+            fastest = &cal;
+        if (max_safe_chip_count(cal, sample_rate) < nchip)
+            continue;
+        unsigned cost = emulator_cost(Emulator_Id{pt, cal.emulator});
+        if (!best || cost > best_cost ||
+            (cost == best_cost && cal.ns_per_chip_frame < best->ns_per_chip_frame)) {
+            best = &cal;
+            best_cost = cost;
+        }
+    }
+
+    if (!arg_emulator_given) {
+        if (best)
+            emulator = best->emulator;
+        else if (fastest)
+            emulator = fastest->emulator;
+    }
+    if (!arg_nchip_given && !best && fastest)
+        nchip = std::max(1u, max_safe_chip_count(*fastest, sample_rate));
+}
+
+// create the players which the channels are routed to, the channels with no
+// route going to the active player, and the threads which render them
+static bool initialize_layers(Player_Type active, unsigned nchip)
+{
+    for (Channel_Route &route : channel_routes) {
+        if (std::all_of(route.gain, route.gain + player_type_count, [](float g) { return g == 0; }))
+            route.gain[(unsigned)active] = 1;
+    }
+
+    for (Player_Type pt : all_player_types) {
+        bool routed = false;
+        for (const Channel_Route &route : channel_routes)
+            routed = routed || route.gain[(unsigned)pt] != 0;
+        if (!routed)
+            continue;
+
+        Player *player = instantiate_player(pt);
+        if (!player)
+            return false;
+        if (pt != active && !player->set_chip_count(nchip))
+            return false;
+
+        Layer_Job &job = ::layer_jobs[::layer_count++];
+        job.player = player;
+        for (unsigned channel = 0; channel < 16; ++channel) {
+            float gain = channel_routes[channel].gain[(unsigned)pt];
+            job.channel_routed[channel] = gain != 0;
+            if (gain != 0)
+                job.gain = gain;
+        }
+    }
+
+    ::layer_buffer.reset(new float[2 * layer_buffer_frames * (::layer_count - 1)]());
+    ::render_pool.reset(new Render_Pool(::layer_count - 1));
+    return true;
+}
+
+static std::unique_ptr<Player> create_player(Player_Type pt);
+
+// the share of a shard in the total of chips, the first ones taking the
+// remainder, and every shard at least one
+static unsigned shard_chip_count(unsigned nchip, unsigned shard, unsigned nshards)
+{
+    return std::max(1u, nchip / nshards + ((shard < nchip % nshards) ? 1 : 0));
+}
+
+// split the channels into groups of consecutive ones, each group played by
+// its own player with a share of the chips
+static bool initialize_shards(Player_Type pt, unsigned noutputs, unsigned nchip, unsigned sample_rate)
+{
+    Player &active = active_player();
+
+    for (unsigned i = 0; i < noutputs; ++i) {
+        Player *player = &active;
+        if (i > 0) {
+            std::unique_ptr<Player> shard = create_player(pt);
+            if (!shard || !shard->set_emulator(emulator_ids[::active_emulator_id].emulator))
+                return false;
+            player = shard.get();
+            ::shard_players.push_back(std::move(shard));
+        }
+        if (!player->set_chip_count(shard_chip_count(nchip, i, noutputs)))
+            return false;
+
+        Layer_Job &job = ::layer_jobs[::layer_count++];
+        job.player = player;
+        for (unsigned channel = 0; channel < 16; ++channel)
+            job.channel_routed[channel] = channel * noutputs / 16 == i;
+    }
+
+    ::shard_dcfilter.reset(new DcFilter[2 * noutputs]);
+    ::shard_lvmonitor.reset(new VuMonitor[2 * noutputs]);
+    for (unsigned i = 0; i < 2 * noutputs; ++i) {
+        ::shard_dcfilter[i].cutoff(dccutoff / sample_rate);
+        ::shard_lvmonitor[i].release(lvrelease * sample_rate);
+    }
+
+    ::render_pool.reset(new Render_Pool(noutputs - 1));
+    ::shard_mode = true;
+    return true;
+}
+
+bool initialize_player(Player_Type pt, unsigned sample_rate, unsigned nchip, const char *bankfile, unsigned emulator, bool quiet, unsigned noutputs)
 {
     qfprintf(quiet, stderr, _("%s version %s\n"), Player::name(pt), Player::version(pt));
 
@@ -151,28 +568,43 @@ bool initialize_player(Player_Type pt, unsigned sample_rate, unsigned nchip, con
         qfprintf(quiet, stderr, _("Error locking memory."));
 #endif
 
-    ::fifo_notify.reset(new Ring_Buffer(fifo_notify_size));
-
-    for (unsigned i = 0; i < player_type_count; ++i) {
-        Player_Type pt = (Player_Type)i;
-        Player *player = Player::create(pt, sample_rate);
-        if (!player) {
-            qfprintf(quiet, stderr, "%s\n", _("Error instantiating player."));
-            return false;
-        }
-        ::player[i].reset(player);
+    ::fifo_midi_queue.reset(new Ring_Buffer(fifo_midi_queue_size));
+    setup_interface_wakeup();
 
-        if (!player->set_embedded_bank(0))
-            qfprintf(quiet, stderr, "%s\n", _("Error setting default bank."));
+    ::bank_cache.reset(new Bank_Cache(arg_bank_cache_budget));
+    if (arg_shared_banks && !::bank_cache->set_shared(true))
+        qfprintf(quiet, stderr, "%s\n", _("Sharing banks between processes is not supported."));
+    for (const char *bankfile : arg_preload_banks) {
+        if (!::bank_cache->preload(bankfile))
+            qfprintf(quiet, stderr, _("Error preloading bank file \"%s\".\n"), bankfile);
+    }
 
-        player->set_soft_pan_enabled(1);
+    ::player_sample_rate = sample_rate;
 
+    for (unsigned i = 0; i < player_type_count; ++i) {
+        Player_Type pt = (Player_Type)i;
         for (const Player::Emulator &e : Player::enumerate_emulators(pt)) {
             Emulator_Id id { pt, e.id };
             emulator_ids.push_back(id);
         }
     }
 
+    std::vector<Emulator_Calibration> calibration;
+    if (arg_calibrate) {
+        qfprintf(quiet, stderr, "%s\n", _("Measuring the cost of the emulators..."));
+        if (!calibrate_emulators(sample_rate, calibration))
+            qfprintf(quiet, stderr, "%s\n", _("Error measuring the cost of the emulators."));
+        else {
+            print_calibration(calibration, sample_rate, quiet);
+            if (!save_calibration(sample_rate, calibration))
+                qfprintf(quiet, stderr, "%s\n", _("Error saving the calibration."));
+        }
+    }
+    else
+        load_calibration(sample_rate, calibration);
+    if (!calibration.empty())
+        preselect_emulator(pt, sample_rate, calibration, emulator, nchip);
+
     auto emulator_id_pos = std::find(
         emulator_ids.begin(), emulator_ids.end(),
         Emulator_Id{ pt, emulator });
@@ -182,6 +614,12 @@ bool initialize_player(Player_Type pt, unsigned sample_rate, unsigned nchip, con
     }
     ::active_emulator_id = std::distance(emulator_ids.begin(), emulator_id_pos);
 
+    // the other players are created when switching to them
+    if (!instantiate_player(pt)) {
+        qfprintf(quiet, stderr, "%s\n", _("Error instantiating player."));
+        return false;
+    }
+
     Player &player = *::player[(unsigned)pt];
     if (!player.set_emulator(emulator)) {
         qfprintf(quiet, stderr, "%s\n", _("Error selecting emulator."));
@@ -194,7 +632,8 @@ bool initialize_player(Player_Type pt, unsigned sample_rate, unsigned nchip, con
         qfprintf(quiet, stderr, "%s\n", _("Using default banks."));
     }
     else {
-        if (!player.load_bank_file(bankfile)) {
+        std::shared_ptr<const Bank> bank = ::bank_cache->load(pt, bankfile);
+        if (!bank || !player.load_bank(bank)) {
             qfprintf(quiet, stderr, "%s\n", _("Error loading bank file."));
             return 1;
         }
@@ -207,6 +646,19 @@ bool initialize_player(Player_Type pt, unsigned sample_rate, unsigned nchip, con
         return 1;
     }
 
+    if (arg_layer && !initialize_layers(pt, nchip)) {
+        qfprintf(quiet, stderr, "%s\n", _("Error setting up the layers."));
+        return false;
+    }
+    if (noutputs > 1 && arg_layer) {
+        qfprintf(quiet, stderr, "%s\n", _("Layers and multiple outputs can not be combined."));
+        return false;
+    }
+    if (noutputs > 1 && !initialize_shards(pt, noutputs, nchip, sample_rate)) {
+        qfprintf(quiet, stderr, "%s\n", _("Error setting up the outputs."));
+        return false;
+    }
+
     qfprintf(quiet, stderr, _("DC filter @ %f Hz, LV monitor @ %f ms\n"), dccutoff, lvrelease * 1e3);
     for (unsigned i = 0; i < 2; ++i) {
         dcfilter[i].cutoff(dccutoff / sample_rate);
@@ -223,89 +675,217 @@ void player_ready(bool quiet)
 {
     Player &player = active_player();
     qfprintf(quiet, stderr, _("%s ready with %u chips.\n"),
-             Player::name(player.type()), player.chip_count());
+             Player::name(player.type()), active_chip_count());
 }
 
-void play_midi(const uint8_t *msg, unsigned len)
+unsigned active_chip_count()
 {
-    Player &player = active_player();
-    auto lock = player.take_lock(std::try_to_lock);
-    if (!lock.owns_lock())
-        return;
+    if (!::shard_mode)
+        return active_player().chip_count();
+    unsigned count = 0;
+    for (unsigned i = 0; i < ::layer_count; ++i)
+        count += ::layer_jobs[i].player->chip_count();
+    return count;
+}
 
-    if (len <= 0)
-        return;
+bool set_active_chip_count(Player &player, unsigned nchip)
+{
+    if (!::shard_mode || &player != ::layer_jobs[0].player)
+        return player.set_chip_count(nchip);
+    bool success = player.set_chip_count(shard_chip_count(nchip, 0, ::layer_count));
+    for (unsigned i = 1; i < ::layer_count; ++i) {
+        Player &shard = *::layer_jobs[i].player;
+        auto lock = shard.take_lock();
+        success = shard.set_chip_count(shard_chip_count(nchip, i, ::layer_count)) && success;
+    }
+    return success;
+}
 
-    uint8_t status = msg[0];
-    if (status == 0xf0)
-        return play_sysex(msg, len);
+// describe the voices of the player, or with several outputs, of all the
+// shards one after another. get the length of the text.
+static unsigned describe_voices(Player &player, char *text, char *attr, unsigned size)
+{
+    if (!::shard_mode) {
+        player.describe_channels(text, attr, size);
+        return std::char_traits<char>::length(text);
+    }
+    unsigned len = 0;
+    text[0] = '\0';
+    for (unsigned i = 0; i < ::layer_count && len + 1 < size; ++i) {
+        ::layer_jobs[i].player->describe_channels(text + len, attr + len, size - len);
+        len += std::char_traits<char>::length(text + len);
+    }
+    return len;
+}
 
-    uint8_t channel = status & 0x0f;
-    switch (status >> 4) {
-    case 0b1001: {
-        if (len < 3) break;
-        unsigned vel = msg[2] & 0x7f;
-        if (vel != 0) {
-            unsigned note = msg[1] & 0x7f;
-            player.rt_note_on(channel, note, vel);
-            if (!midi_channel_note_active[channel][note]) {
-                ++midi_channel_note_count[channel];
-                midi_channel_note_active[channel][note] = true;
-            }
-            midi_channel_last_note_p1[channel] = note + 1;
-            break;
+Channel_Controls::Channel_Controls()
+{
+    std::fill(controller, controller + 120, 0xff);
+    std::fill(note_velocity, note_velocity + 128, 0);
+}
+
+void Channel_Controls::controller_change(unsigned cc, unsigned val)
+{
+    if (cc < 120)
+        controller[cc] = val;
+    if (cc == 98 || cc == 99)
+        registered_parameter = false;
+    else if (cc == 100 || cc == 101)
+        registered_parameter = true;
+    else if (cc == 121) {
+        std::fill(controller, controller + 120, 0xff);
+        pitchbend = 8192;
+        aftertouch = 0;
+    }
+}
+
+void Channel_Controls::replay(Player &player, unsigned channel) const
+{
+    for (unsigned cc = 0; cc < 120; ++cc) {
+        bool parameter = cc == 6 || cc == 38 || (cc >= 96 && cc <= 101);
+        if (cc == 0 || cc == 32 || parameter || controller[cc] == 0xff)
+            continue;
+        player.rt_controller_change(channel, cc, controller[cc]);
+    }
+    // select the last parameter again, then enter its data
+    const unsigned registered[] = {101, 100, 6, 38};
+    const unsigned nonregistered[] = {99, 98, 6, 38};
+    for (unsigned cc : registered_parameter ? registered : nonregistered) {
+        if (controller[cc] != 0xff)
+            player.rt_controller_change(channel, cc, controller[cc]);
+    }
+    player.rt_pitchbend(channel, pitchbend);
+    player.rt_channel_aftertouch(channel, aftertouch);
+}
+
+// on the audio side, record the state after an event which the players
+// received
+static void track_event(const Player::Event &event)
+{
+    unsigned channel = event.channel;
+    Channel_Controls &ctl = channel_controls[channel];
+    switch (event.type) {
+    case Player::Event::Note_On: {
+        unsigned note = event.key;
+        if (!midi_channel_note_active[channel][note]) {
+            ++midi_channel_note_count[channel];
+            midi_channel_note_active[channel][note] = true;
         }
+        ctl.note_velocity[note] = event.value;
+        midi_channel_last_note_p1[channel] = note + 1;
+        ::ui_dirty = true;
+        break;
     }
-    case 0b1000: {
-        if (len < 3) break;
-        unsigned note = msg[1] & 0x7f;
-        player.rt_note_off(channel, note);
+    case Player::Event::Note_Off: {
+        unsigned note = event.key;
         if (midi_channel_note_active[channel][note]) {
             --midi_channel_note_count[channel];
             midi_channel_note_active[channel][note] = false;
+            ::ui_dirty = true;
         }
         break;
     }
-    case 0b1010:
-        if (len < 3) break;
-        player.rt_note_aftertouch(channel, msg[1] & 0x7f, msg[2] & 0x7f);
+    case Player::Event::Channel_Aftertouch:
+        ctl.aftertouch = event.value;
         break;
-    case 0b1101:
-        if (len < 2) break;
-        player.rt_channel_aftertouch(channel, msg[1] & 0x7f);
-        break;
-    case 0b1011: {
-        if (len < 3) break;
-        unsigned cc = msg[1] & 0x7f;
-        unsigned val = msg[2] & 0x7f;
-        player.rt_controller_change(channel, cc, val);
+    case Player::Event::Controller: {
+        unsigned cc = event.key;
+        unsigned val = event.value;
+        ctl.controller_change(cc, val);
         if (cc == 120 || cc == 123) {
             midi_channel_note_count[channel] = 0;
             midi_channel_note_active[channel].reset();
+            ::ui_dirty = true;
         }
         else if (cc == 0) {
             channel_map[channel].bank_msb = val;
+            ::ui_dirty = true;
+            ::rt_snapshot_due = true;
         }
         else if (cc == 32) {
             channel_map[channel].bank_lsb = val;
+            ::ui_dirty = true;
+            ::rt_snapshot_due = true;
         }
         break;
     }
-    case 0b1100: {
-        if (len < 2) break;
-        unsigned pgm = msg[1] & 0x7f;
-        player.rt_program_change(channel, pgm);
-        channel_map[channel].gm = pgm;
+    case Player::Event::Program:
+        channel_map[channel].gm = event.value;
+        ::ui_dirty = true;
+        ::rt_snapshot_due = true;
         break;
-    }
-    case 0b1110:
-        if (len < 3) break;
-        unsigned value = (msg[1] & 0x7f) | ((msg[2] & 0x7f) << 7);
-        player.rt_pitchbend(channel, value);
+    case Player::Event::Pitchbend:
+        ctl.pitchbend = event.value;
         break;
+    default:
+        break;
+    }
+}
+
+// on the audio side, once the players received the events of the block
+static void finish_block_events()
+{
+    for (unsigned i = 0, n = ::block_event_count; i < n; ++i)
+        track_event(::block_events[i]);
+    ::block_event_count = 0;
+}
+
+// whether dropping the event could leave a note playing
+static bool releases_notes(const Player::Event &event)
+{
+    return event.type == Player::Event::Note_Off ||
+        (event.type == Player::Event::Controller &&
+         (event.key == 120 || event.key == 121 || event.key == 123));
+}
+
+static bool flush_block_events();
+
+void play_midi(const uint8_t *msg, unsigned len)
+{
+    if (len <= 0)
+        return;
+
+    if (msg[0] == 0xf0)
+        return play_sysex(msg, len);
+
+    // the players take the events of the block at once, when rendering it
+    Player::Event event;
+    if (!Player::decode_event(msg, len, event))
+        return;
+    if (::block_event_count >= block_event_max && !flush_block_events()) {
+        if (!releases_notes(event) || ::block_event_count == block_event_max + block_event_reserve)
+            return;
+    }
+    ::block_events[::block_event_count++] = event;
+}
+
+bool queue_midi(const uint8_t *msg, unsigned len)
+{
+    Ring_Buffer *fifo = ::fifo_midi_queue.get();
+    if (!fifo || len <= 0 || len > midi_message_max_size || fifo->size_free() < 1 + len)
+        return false;
+    fifo->put((uint8_t)len);
+    fifo->put(msg, len);
+    return true;
+}
+
+// on the audio side, play the messages which were queued for it
+static void play_queued_midi()
+{
+    Ring_Buffer *fifo = ::fifo_midi_queue.get();
+    if (!fifo)
+        return;
+    uint8_t len;
+    uint8_t msg[midi_message_max_size];
+    while (fifo->peek(len) && fifo->size_used() >= 1u + len) {
+        fifo->discard(1);
+        fifo->get(msg, len);
+        play_midi(msg, len);
     }
 }
 
+static void post_notification(Notification_Type type, const uint8_t *data, unsigned len);
+
 static void play_roland_sysex(unsigned address, const uint8_t *data, unsigned len)
 {
     switch (address) {
@@ -316,7 +896,7 @@ static void play_roland_sc_sysex(unsigned address, const uint8_t *data, unsigned
 {
     switch (address) {
     case 0x100000:  // text insert
-        notify(Notify_TextInsert, data, (len < 256) ? len : 256); break;
+        post_notification(Notify_TextInsert, data, len); break;
     }
 }
 
@@ -351,93 +931,734 @@ void play_sysex(const uint8_t *msg, unsigned len)
     }
 }
 
-bool notify(Notification_Type type, const uint8_t *data, unsigned len)
+static void post_notification(Notification_Type type, const uint8_t *data, unsigned len)
 {
-    Ring_Buffer *fifo = ::fifo_notify.get();
-    if (!fifo)
-        return false;
-    Notify_Header hdr = {type, len};
-    if (fifo->size_free() < sizeof(hdr) + len)
-        return false;
-    fifo->put(hdr);
-    fifo->put(data, len);
-    return true;
+    ::notification_bus.post(type, data, len);
+    wakeup_interface();
 }
 
-void generate_outputs(float *left, float *right, unsigned nframes, unsigned stride)
+void set_channel_description(bool enable)
 {
-    if (nframes <= 0)
-        return;
+    if (enable)
+        ::channels_update_enabled.fetch_add(1);
+    else
+        ::channels_update_enabled.fetch_sub(1);
+}
 
-    Player &player = active_player();
-    auto lock = player.take_lock(std::try_to_lock);
-    if (!lock.owns_lock()) {
-        for (unsigned i = 0; i < nframes; ++i) {
-            float *leftp = &left[i * stride];
-            float *rightp = &right[i * stride];
-            *leftp = 0;
-            *rightp = 0;
-        }
+unsigned long read_audio_snapshot(Audio_Snapshot &snapshot)
+{
+    return ::audio_snapshot.load(snapshot);
+}
+
+// on the audio side, publish the snapshot with the state of the channels
+static void publish_snapshot()
+{
+    Audio_Snapshot &snap = ::rt_snapshot;
+    std::copy(::channel_map, ::channel_map + 16, snap.program);
+    std::copy(::midi_channel_note_count, ::midi_channel_note_count + 16, snap.note_count);
+    std::copy(::midi_channel_note_active, ::midi_channel_note_active + 16, snap.note_active);
+    std::copy(::midi_channel_last_note_p1, ::midi_channel_last_note_p1 + 16, snap.last_note_p1);
+    ::audio_snapshot.store(snap);
+
+    snap.cpuratio = 0;
+    ::rt_snapshot_due = false;
+}
+
+// on the audio side, while freewheeling, show no levels. the changes of
+// the channels are published still.
+static void clear_snapshot_levels()
+{
+    if (::rt_snapshot_cleared) {
+        if (::rt_snapshot_due)
+            publish_snapshot();
         return;
     }
+    Audio_Snapshot &snap = ::rt_snapshot;
+    snap.lvcurrent[0] = snap.lvcurrent[1] = 0;
+    snap.cpuratio = 0;
+    publish_snapshot();
+    ::rt_snapshot_cleared = true;
+}
 
-    Player::Audio_Format format;
-    format.type = ADLMIDI_SampleType_F32;
-    format.containerSize = sizeof(float);
-    format.sampleOffset = stride * sizeof(float);
-    stc::steady_clock::time_point t_before_gen = stc::steady_clock::now();
-    player.generate(nframes, left, right, format);
-    stc::steady_clock::time_point t_after_gen = stc::steady_clock::now();
-    lock.unlock();
+static void setup_interface_wakeup()
+{
+    if (::ui_wakeup_fd[0] != -1)
+        return;
+#if defined(__linux__)
+    int fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    ::ui_wakeup_fd[0] = ::ui_wakeup_fd[1] = fd;
+#elif !defined(_WIN32)
+    int fds[2];
+    if (pipe(fds) == 0) {
+        for (int fd : fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+        }
+        ::ui_wakeup_fd[0] = fds[0];
+        ::ui_wakeup_fd[1] = fds[1];
+    }
+#endif
+}
 
-    DcFilter &dclf = dcfilter[0];
-    DcFilter &dcrf = dcfilter[1];
-    double lvcurrent[2];
+void wakeup_interface()
+{
+    int fd = ::ui_wakeup_fd[1];
+    if (fd == -1 || ::ui_wakeup_pending.exchange(true))
+        return;
+#if defined(__linux__)
+    uint64_t value = 1;
+#else
+    uint8_t value = 1;
+#endif
+    ssize_t count = write(fd, &value, sizeof(value));
+    (void)count;
+}
 
-    const double outputgain = ::player_volume * (1.0 / 100.0) * player.output_gain();
-    for (unsigned i = 0; i < nframes; ++i) {
-        float *leftp = &left[i * stride];
-        float *rightp = &right[i * stride];
-        double left_sample = dclf.process(outputgain * *leftp);
-        double right_sample = dcrf.process(outputgain * *rightp);
-        lvcurrent[0] = lvmonitor[0].process(left_sample);
-        lvcurrent[1] = lvmonitor[1].process(right_sample);
-        *leftp = left_sample;
-        *rightp = right_sample;
-    }
+int interface_wakeup_fd()
+{
+    return ::ui_wakeup_fd[0];
+}
 
-    ::lvcurrent[0] = lvcurrent[0];
-    ::lvcurrent[1] = lvcurrent[1];
+void acknowledge_interface_wakeup()
+{
+    int fd = ::ui_wakeup_fd[0];
+    if (fd == -1)
+        return;
+    uint8_t buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0);
+    ::ui_wakeup_pending.store(false);
+}
 
-    stc::steady_clock::duration d_gen = t_after_gen - t_before_gen;
-    double d_sec = 1e-6 * stc::duration_cast<stc::microseconds>(d_gen).count();
-    ::cpuratio = d_sec / ((double)nframes / player.sample_rate());
+// on the audio side, give the channel state to the incoming player,
+// whose lock is held
+static void start_player_switch(Player &player)
+{
+    Player_Switch &sw = ::player_switch;
+    sw.outgoing = &active_player();
+    sw.fade_position = 0;
+
+    for (unsigned channel = 0; channel < 16; ++channel) {
+        const Program &pgm = channel_map[channel];
+        const Channel_Controls &ctl = channel_controls[channel];
+        player.rt_bank_change_msb(channel, pgm.bank_msb);
+        player.rt_bank_change_lsb(channel, pgm.bank_lsb);
+        player.rt_program_change(channel, pgm.gm);
+        ctl.replay(player, channel);
+        for (unsigned note = 0; note < 128; ++note) {
+            if (midi_channel_note_active[channel][note])
+                player.rt_note_on(channel, note, ctl.note_velocity[note]);
+        }
+    }
 
-    if (::channels_update_left > nframes)
-        ::channels_update_left -= nframes;
-    else {
-        ::channels_update_left = ::channels_update_frames -
-            (nframes - ::channels_update_left) % ::channels_update_frames;
+    ::player_switch_state.store(Switch_Fading, std::memory_order_release);
+}
 
-        char buf[2 * (player_max_chips * player_max_channels + 1)];
-        char *text = buf;
-        char *attr = buf + player_max_chips * player_max_channels + 1;
-        player.describe_channels(text, attr, sizeof(buf) / 2);
+// on the audio side, mix the incoming player over the output of the
+// outgoing one, at equal power, and apply the gains of both
+static void crossfade_player_switch(Player &incoming, float *left, float *right, unsigned nframes, unsigned stride)
+{
+    Player_Switch &sw = ::player_switch;
+    const double outgoing_gain = sw.outgoing->output_gain();
+    const double incoming_gain = incoming.output_gain();
+    const double half_pi = 1.57079632679489661923;
 
-        unsigned len = std::char_traits<char>::length(text);
-        std::move(attr, attr + len, text + len);
-        notify(Notify_Channels, (const uint8_t *)buf, 2 * len);
+    float buf[2 * player_switch_chunk];
+    Player::Audio_Format format;
+    format.type = ADLMIDI_SampleType_F32;
+    format.containerSize = sizeof(float);
+    format.sampleOffset = 2 * sizeof(float);
+
+    for (unsigned i = 0; i < nframes;) {
+        unsigned count = std::min(nframes - i, player_switch_chunk);
+        incoming.generate(count, &buf[0], &buf[1], format);
+        for (unsigned j = 0; j < count; ++j, ++i) {
+            double x = (sw.fade_position < sw.fade_frames) ?
+                (double)sw.fade_position++ / sw.fade_frames : 1.0;
+            double a = outgoing_gain * std::cos(x * half_pi);
+            double b = incoming_gain * std::sin(x * half_pi);
+            float *leftp = &left[i * stride];
+            float *rightp = &right[i * stride];
+            *leftp = a * *leftp + b * buf[2 * j];
+            *rightp = a * *rightp + b * buf[2 * j + 1];
+        }
     }
+
+    // the outgoing player is in use until the end of this block
+    if (sw.fade_position >= sw.fade_frames)
+        ::player_switch_state.store(Switch_Faded, std::memory_order_release);
 }
 
-void dynamic_switch_emulator_id(unsigned index)
+// on the audio side, take the occupation of the voices from the channel
+// description, or from the held notes if more than the voices
+static void measure_voice_pressure(const char *text, unsigned len)
 {
-    if (index == active_emulator_id)
+    if (len == 0)
+        return;
+
+    unsigned busy = 0;
+    for (unsigned i = 0; i < len; ++i)
+        busy += text[i] != '-' && text[i] != ' ';
+    unsigned notes = 0;
+    for (unsigned channel = 0; channel < 16; ++channel)
+        notes += midi_channel_note_count[channel];
+
+    unsigned pressure = 1000 * std::max(busy, notes) / len;
+    unsigned peak = ::voice_pressure_peak.load(std::memory_order_relaxed);
+    while (pressure > peak &&
+           !::voice_pressure_peak.compare_exchange_weak(peak, pressure, std::memory_order_relaxed));
+}
+
+static void process_output(float *left, float *right, unsigned nframes, unsigned stride, double outputgain, DcFilter dcfilter[2], VuMonitor lvmonitor[2], double lvcurrent[2]);
+static void finish_block(unsigned nframes, stc::steady_clock::duration d_gen, const double lvcurrent[2], Player &player);
+
+// on the audio side, the player which renders in the state of the switch,
+// and during the fade, the incoming one which receives the events also
+static Player &switch_receiver(int switch_state, Player *&fading)
+{
+    // the interface writes the pointer while idle only
+    fading = (switch_state == Switch_Fading) ? ::player_switch.incoming : nullptr;
+    bool taken_over = switch_state == Switch_Faded || switch_state == Switch_Finished;
+    return taken_over ? *::player_switch.incoming : active_player();
+}
+
+// on the audio side, take the lock of the player of each layer, and get
+// whether all of them are held
+static bool lock_layers(std::unique_lock<std::mutex> locks[], unsigned count)
+{
+    bool all = true;
+    for (unsigned i = 0; i < count; ++i) {
+        Layer_Job &job = ::layer_jobs[i];
+        locks[i] = job.player->take_lock(std::try_to_lock);
+        job.rendered = locks[i].owns_lock();
+        all = all && job.rendered;
+    }
+    return all;
+}
+
+// send the events of the block to a layer, those of its channels
+static void dispatch_layer_events(Layer_Job &job)
+{
+    Player::Event events[block_event_max + block_event_reserve];
+    unsigned count = 0;
+    for (unsigned i = 0, n = ::block_event_count; i < n; ++i) {
+        const Player::Event &event = ::block_events[i];
+        if (job.channel_routed[event.channel])
+            events[count++] = event;
+    }
+    job.player->rt_events(events, count);
+}
+
+// on the audio side, give the events to the players before the block, if
+// none of them is locked
+static bool flush_block_events()
+{
+    if (::layer_count) {
+        std::unique_lock<std::mutex> locks[layer_max];
+        if (!lock_layers(locks, ::layer_count))
+            return false;
+        for (unsigned i = 0; i < ::layer_count; ++i)
+            dispatch_layer_events(::layer_jobs[i]);
+    }
+    else {
+        int switch_state = ::player_switch_state.load(std::memory_order_acquire);
+        Player *fading;
+        Player &player = switch_receiver(switch_state, fading);
+        auto lock = player.take_lock(std::try_to_lock);
+        std::unique_lock<std::mutex> fading_lock;
+        if (fading)
+            fading_lock = fading->take_lock(std::try_to_lock);
+        if (!lock.owns_lock() || (fading && !fading_lock.owns_lock()))
+            return false;
+        if (fading)
+            fading->rt_events(::block_events, ::block_event_count);
+        player.rt_events(::block_events, ::block_event_count);
+    }
+    finish_block_events();
+    return true;
+}
+
+// render the active player, or during a switch, the players which play.
+// false if a player is locked, the events staying for a later block.
+// the gain is left to apply to the output.
+static bool render_active_player(float *left, float *right, unsigned nframes, unsigned stride, double &gain, Player *&described)
+{
+    int switch_state = ::player_switch_state.load(std::memory_order_acquire);
+    if (switch_state == Switch_Faded) {
+        // the previous block was the last to use the outgoing player
+        switch_state = Switch_Finished;
+        ::player_switch_state.store(Switch_Finished, std::memory_order_release);
+        wakeup_interface();
+    }
+    else if (switch_state == Switch_Installed) {
+        // the interface may prepare another switch from now on
+        switch_state = Switch_Idle;
+        ::player_switch_state.store(Switch_Idle, std::memory_order_release);
+    }
+    Player *switch_incoming = (switch_state != Switch_Idle) ?
+        ::player_switch.incoming : nullptr;
+    Player *incoming;
+    Player &player = switch_receiver(switch_state, incoming);
+
+    auto lock = player.take_lock(std::try_to_lock);
+    if (!lock.owns_lock())
+        return false;
+
+    // during the fade, both players receive the events, or none does
+    std::unique_lock<std::mutex> incoming_lock;
+    if (switch_state == Switch_Fading || switch_state == Switch_Pending)
+        incoming_lock = switch_incoming->take_lock(std::try_to_lock);
+    if (incoming) {
+        if (!incoming_lock.owns_lock())
+            return false;
+        incoming->rt_events(::block_events, ::block_event_count);
+    }
+    player.rt_events(::block_events, ::block_event_count);
+    finish_block_events();
+
+    // a player which takes over now has the state after these events.
+    // if it is locked, it takes over at a later block.
+    if (switch_state == Switch_Pending && incoming_lock.owns_lock()) {
+        start_player_switch(*switch_incoming);
+        incoming = switch_incoming;
+    }
+
+    Player::Audio_Format format;
+    format.type = ADLMIDI_SampleType_F32;
+    format.containerSize = sizeof(float);
+    format.sampleOffset = stride * sizeof(float);
+    player.generate(nframes, left, right, format);
+    if (!incoming)
+        gain = player.output_gain();
+    else {
+        crossfade_player_switch(*incoming, left, right, nframes, stride);
+        gain = 1;
+    }
+
+    described = &player;
+    return true;
+}
+
+// on the audio side, send the events of the block to a layer, and render
+// it. the audio thread holds the lock of the player.
+static void render_layer(void *data)
+{
+    Layer_Job &job = *(Layer_Job *)data;
+    Player &player = *job.player;
+
+    if (!job.rendered)
+        return;
+
+    if (job.dispatch)
+        dispatch_layer_events(job);
+
+    Player::Audio_Format format;
+    format.type = ADLMIDI_SampleType_F32;
+    format.containerSize = sizeof(float);
+    format.sampleOffset = job.stride * sizeof(float);
+    player.generate(job.nframes, job.left, job.right, format);
+}
+
+// render all the layers in parallel, and mix them into the output
+static bool render_layers(float *left, float *right, unsigned nframes, unsigned stride, Player *&described)
+{
+    unsigned count = ::layer_count;
+    void *jobs[layer_max];
+    bool rendered = false;
+
+    // the layers which are unlocked render, but receive the events only
+    // if all of them do
+    std::unique_lock<std::mutex> locks[layer_max];
+    bool dispatch = lock_layers(locks, count);
+
+    for (unsigned offset = 0; offset < nframes;) {
+        unsigned segment = std::min(nframes - offset, layer_buffer_frames);
+        for (unsigned i = 0; i < count; ++i) {
+            Layer_Job &job = ::layer_jobs[i];
+            // the first layer renders into the output, the others on the side
+            job.left = (i == 0) ? &left[offset * stride] : &::layer_buffer[2 * layer_buffer_frames * (i - 1)];
+            job.right = (i == 0) ? &right[offset * stride] : (job.left + 1);
+            job.stride = (i == 0) ? stride : 2;
+            job.nframes = segment;
+            job.dispatch = dispatch && offset == 0;
+            jobs[i] = &job;
+        }
+        ::render_pool->run(&render_layer, jobs, count);
+        if (dispatch && offset == 0)
+            finish_block_events();
+
+        for (unsigned i = 0; i < count; ++i) {
+            const Layer_Job &job = ::layer_jobs[i];
+            double gain = job.rendered ? job.gain * job.player->output_gain() : 0.0;
+            rendered = rendered || job.rendered;
+            for (unsigned j = 0; j < segment; ++j) {
+                float *leftp = &left[(offset + j) * stride];
+                float *rightp = &right[(offset + j) * stride];
+                if (i == 0) {
+                    *leftp = gain * *leftp;
+                    *rightp = gain * *rightp;
+                }
+                else {
+                    *leftp += gain * job.left[2 * j];
+                    *rightp += gain * job.right[2 * j];
+                }
+            }
+        }
+        offset += segment;
+    }
+
+    described = &active_player();
+    return rendered;
+}
+
+void generate_outputs(float *left, float *right, unsigned nframes, unsigned stride)
+{
+    if (nframes <= 0)
+        return;
+
+    play_queued_midi();
+
+    double gain = 1;
+    Player *described = nullptr;
+    stc::steady_clock::time_point t_before_gen = stc::steady_clock::now();
+    bool rendered = ::layer_count ?
+        render_layers(left, right, nframes, stride, described) :
+        render_active_player(left, right, nframes, stride, gain, described);
+    stc::steady_clock::time_point t_after_gen = stc::steady_clock::now();
+
+    if (!rendered) {
+        for (unsigned i = 0; i < nframes; ++i) {
+            float *leftp = &left[i * stride];
+            float *rightp = &right[i * stride];
+            *leftp = 0;
+            *rightp = 0;
+        }
+        // the events flushed before the block were played nevertheless
+        if (::rt_snapshot_due)
+            publish_snapshot();
+        return;
+    }
+
+    const double outputgain = ::player_volume * (1.0 / 100.0) * gain;
+    if (::freewheeling.load(std::memory_order_relaxed)) {
+        process_output(left, right, nframes, stride, outputgain, ::dcfilter, nullptr, nullptr);
+        clear_snapshot_levels();
+        return;
+    }
+
+    double lvcurrent[2];
+    process_output(left, right, nframes, stride, outputgain, ::dcfilter, ::lvmonitor, lvcurrent);
+    finish_block(nframes, t_after_gen - t_before_gen, lvcurrent, *described);
+}
+
+// render each shard into its output, in parallel
+void generate_multi_outputs(float *const left[], float *const right[], unsigned noutputs, unsigned nframes)
+{
+    if (nframes <= 0)
+        return;
+
+    play_queued_midi();
+
+    unsigned count = std::min(noutputs, ::layer_count);
+    void *jobs[layer_max];
+    std::unique_lock<std::mutex> locks[layer_max];
+    bool dispatch = lock_layers(locks, count);
+    for (unsigned i = 0; i < count; ++i) {
+        Layer_Job &job = ::layer_jobs[i];
+        job.left = left[i];
+        job.right = right[i];
+        job.stride = 1;
+        job.nframes = nframes;
+        job.dispatch = dispatch;
+        jobs[i] = &job;
+    }
+
+    stc::steady_clock::time_point t_before_gen = stc::steady_clock::now();
+    ::render_pool->run(&render_layer, jobs, count);
+    stc::steady_clock::time_point t_after_gen = stc::steady_clock::now();
+    if (dispatch)
+        finish_block_events();
+
+    const double volume = ::player_volume * (1.0 / 100.0);
+    const bool metering = !::freewheeling.load(std::memory_order_relaxed);
+    double lvcurrent[2] = {};
+    for (unsigned i = 0; i < noutputs; ++i) {
+        const Layer_Job *job = (i < count) ? &::layer_jobs[i] : nullptr;
+        if (!job || !job->rendered) {
+            std::fill(left[i], left[i] + nframes, 0.0f);
+            std::fill(right[i], right[i] + nframes, 0.0f);
+            continue;
+        }
+        double lv[2] = {};
+        process_output(left[i], right[i], nframes, 1, volume * job->player->output_gain(),
+                       &::shard_dcfilter[2 * i], metering ? &::shard_lvmonitor[2 * i] : nullptr, lv);
+        lvcurrent[0] = std::max(lvcurrent[0], lv[0]);
+        lvcurrent[1] = std::max(lvcurrent[1], lv[1]);
+    }
+
+    if (metering)
+        finish_block(nframes, t_after_gen - t_before_gen, lvcurrent, active_player());
+    else
+        clear_snapshot_levels();
+}
+
+// apply the gain and the DC filter, and measure the level
+static void process_output(float *left, float *right, unsigned nframes, unsigned stride, double outputgain, DcFilter dcfilter[2], VuMonitor lvmonitor[2], double lvcurrent[2])
+{
+    DcFilter &dclf = dcfilter[0];
+    DcFilter &dcrf = dcfilter[1];
+
+    if (!lvmonitor) {
+        for (unsigned i = 0; i < nframes; ++i) {
+            float *leftp = &left[i * stride];
+            float *rightp = &right[i * stride];
+            *leftp = dclf.process(outputgain * *leftp);
+            *rightp = dcrf.process(outputgain * *rightp);
+        }
+        return;
+    }
+
+    for (unsigned i = 0; i < nframes; ++i) {
+        float *leftp = &left[i * stride];
+        float *rightp = &right[i * stride];
+        double left_sample = dclf.process(outputgain * *leftp);
+        double right_sample = dcrf.process(outputgain * *rightp);
+        lvcurrent[0] = lvmonitor[0].process(left_sample);
+        lvcurrent[1] = lvmonitor[1].process(right_sample);
+        *leftp = left_sample;
+        *rightp = right_sample;
+    }
+}
+
+// after a block, update the measurements and the interface
+static void finish_block(unsigned nframes, stc::steady_clock::duration d_gen, const double lvcurrent[2], Player &player)
+{
+    Audio_Snapshot &snap = ::rt_snapshot;
+    snap.lvcurrent[0] = lvcurrent[0];
+    snap.lvcurrent[1] = lvcurrent[1];
+    ::rt_snapshot_cleared = false;
+
+    double d_sec = 1e-6 * stc::duration_cast<stc::microseconds>(d_gen).count();
+    double cpuratio = d_sec / ((double)nframes / ::player_sample_rate);
+    snap.cpuratio = std::max(snap.cpuratio, cpuratio);
+
+    if (::arg_governor_high) {
+        unsigned bucket = std::min(callback_cost_buckets - 1,
+                                   (unsigned)(cpuratio / callback_cost_bucket_width));
+        ::callback_cost_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (::channels_update_left > nframes)
+        ::channels_update_left -= nframes;
+    else {
+        ::channels_update_left = ::channels_update_frames -
+            (nframes - ::channels_update_left) % ::channels_update_frames;
+
+        bool describe = ::channels_update_enabled.load(std::memory_order_relaxed) > 0;
+        if (describe || ::arg_nchip_max) {
+            // the letters, then the attributes moved after them
+            Notification_Value &value = ::rt_channels;
+            char *text = (char *)value.data;
+            char *attr = text + notification_slot_size_max / 2;
+            unsigned len = describe_voices(player, text, attr, notification_slot_size_max / 2);
+
+            if (::arg_nchip_max)
+                measure_voice_pressure(text, len);
+
+            if (describe) {
+                std::move(attr, attr + len, text + len);
+                value.size = 2 * len;
+                ::notification_bus.set(Notify_Channels, value);
+            }
+        }
+
+        // wake the interface only if it has something new to display.
+        // the daemon displays nothing, it reads the values when asked.
+        bool active = lvcurrent[0] > ui_lv_idle || lvcurrent[1] > ui_lv_idle;
+        bool wake = !::arg_daemon && (active || ::ui_active || ::ui_dirty || describe ||
+                                      std::fabs(snap.cpuratio - ::ui_cpuratio) > ui_cpuratio_delta);
+        if (wake)
+            ::ui_cpuratio = snap.cpuratio;
+        ::ui_active = active;
+        ::ui_dirty = false;
+
+        publish_snapshot();
+        if (wake)
+            wakeup_interface();
+    }
+
+    if (::rt_snapshot_due)
+        publish_snapshot();
+}
+
+// create a player with the bank of its type
+static std::unique_ptr<Player> create_player(Player_Type pt)
+{
+    std::unique_ptr<Player> player(Player::create(pt, ::player_sample_rate));
+    if (!player)
+        return nullptr;
+
+    std::shared_ptr<const Bank> bank;
+    if (have_player(pt))
+        bank = ::player[(unsigned)pt]->bank();
+    const std::string &bankfile = ::player_bank_file[(unsigned)pt];
+    if (!bank && !bankfile.empty())
+        bank = ::bank_cache->load(pt, bankfile.c_str());
+    if (bank)
+        player->load_bank(bank);
+    else if (!load_default_bank(*player))
+        debug_printf("Error setting default bank.");
+
+    player->set_soft_pan_enabled(::soft_pan_enabled);
+    return player;
+}
+
+Player *instantiate_player(Player_Type pt)
+{
+    std::unique_ptr<Player> &slot = ::player[(unsigned)pt];
+    if (slot)
+        return slot.get();
+
+    std::unique_ptr<Player> player = create_player(pt);
+    if (!player)
+        return nullptr;
+
+    // the programs which the audio side published last
+    Audio_Snapshot snapshot;
+    read_audio_snapshot(snapshot);
+    for (unsigned channel = 0; channel < 16; ++channel) {
+        const Program &pgm = snapshot.program[channel];
+        player->rt_bank_change_msb(channel, pgm.bank_msb);
+        player->rt_bank_change_lsb(channel, pgm.bank_lsb);
+        player->rt_program_change(channel, pgm.gm);
+    }
+
+    slot = std::move(player);
+    ::player_inactive_since[(unsigned)pt] = stc::steady_clock::now();
+    return slot.get();
+}
+
+void release_inactive_players(stc::steady_clock::time_point &deadline)
+{
+    if (::arg_player_timeout == 0 || !have_active_player() || ::layer_count)
+        return;
+
+    const stc::seconds inactive_delay(::arg_player_timeout);
+    stc::steady_clock::time_point now = stc::steady_clock::now();
+    Player_Type active = (Player_Type)active_player_index();
+
+    for (unsigned i = 0; i < player_type_count; ++i) {
+        Player_Type pt = (Player_Type)i;
+        if (pt == active || !have_player(pt))
+            continue;
+        // the audio thread does not use an inactive player
+        stc::steady_clock::time_point expiry = ::player_inactive_since[i] + inactive_delay;
+        if (now >= expiry) {
+            debug_printf("Releasing inactive player %s.", Player::name(pt));
+            ::player[i].reset();
+        }
+        else
+            deadline = std::min(deadline, expiry);
+    }
+}
+
+bool switch_player(std::unique_ptr<Player> player, unsigned emulator_index, unsigned fade_frames)
+{
+    // the layers keep their players
+    if (::layer_count || player_switch_busy())
+        return false;
+
+    Player_Switch &sw = ::player_switch;
+    sw.owned = std::move(player);
+    sw.incoming = sw.owned.get();
+    sw.emulator_index = emulator_index;
+    sw.fade_frames = fade_frames;
+    ::player_switch_state.store(Switch_Pending, std::memory_order_release);
+    return true;
+}
+
+bool player_switch_busy()
+{
+    return ::player_switch_state.load(std::memory_order_acquire) != Switch_Idle;
+}
+
+void finish_player_switch()
+{
+    if (::player_switch_state.load(std::memory_order_acquire) != Switch_Finished)
         return;
 
+    // the audio does not use the outgoing player anymore. it keeps using
+    // the incoming one through the pointer, until it sees the new state.
+    Player_Switch &sw = ::player_switch;
+    Player_Type old_type = (Player_Type)active_player_index();
+    Player_Type new_type = sw.incoming->type();
+    std::unique_ptr<Player> outgoing = std::move(::player[(unsigned)old_type]);
+    std::unique_ptr<Player> replaced = std::move(::player[(unsigned)new_type]);
+    ::player[(unsigned)new_type] = std::move(sw.owned);
+    ::active_emulator_id = sw.emulator_index;
+    ::player_switch_state.store(Switch_Installed, std::memory_order_release);
+}
+
+static unsigned crossfade_frames(unsigned ms)
+{
+    return std::max(1u, (unsigned)((uint64_t)ms * ::player_sample_rate / 1000));
+}
+
+// prepare the player of the emulator, in the state of the active player,
+// and crossfade into it
+static bool crossfade_switch_emulator_id(unsigned index, unsigned fade_ms)
+{
+    Emulator_Id new_id = emulator_ids[index];
+    std::unique_ptr<Player> player = create_player(new_id.player);
+    if (!player || !player->set_emulator(new_id.emulator) ||
+        !player->set_chip_count(active_player().chip_count()))
+        return false;
+
+    return switch_player(std::move(player), index, crossfade_frames(fade_ms));
+}
+
+// in layer mode, change the emulator of one layer, and make it active
+static bool layer_switch_emulator_id(unsigned index)
+{
+    Emulator_Id id = emulator_ids[index];
+    if (::shard_mode) {
+        // the shards are all of the same player
+        if (id.player != emulator_ids[::active_emulator_id].player)
+            return false;
+        for (unsigned i = 0; i < ::layer_count; ++i)
+            ::layer_jobs[i].player->dynamic_set_emulator(id.emulator);
+        ::active_emulator_id = index;
+        return true;
+    }
+
+    Player *player = instantiate_player(id.player);
+    if (!player || !player->dynamic_set_emulator(id.emulator))
+        return false;
+    ::active_emulator_id = index;
+    return true;
+}
+
+bool dynamic_switch_emulator_id(unsigned index)
+{
+    if (index == active_emulator_id)
+        return true;
+    if (player_switch_busy())
+        return false;
+    if (::layer_count)
+        return layer_switch_emulator_id(index);
+    if (::arg_crossfade_ms > 0)
+        return crossfade_switch_emulator_id(index, ::arg_crossfade_ms);
+
     Emulator_Id old_id = emulator_ids[active_emulator_id];
     Emulator_Id new_id  = emulator_ids[index];
 
+    // prepare the other player before interrupting the audio
+    if (old_id.player != new_id.player && !instantiate_player(new_id.player))
+        return false;
+
+    // the programs which the audio side published last
+    Audio_Snapshot snapshot;
+    read_audio_snapshot(snapshot);
+
     Player &player = active_player();
     auto lock = player.take_lock();
 
@@ -447,17 +1668,322 @@ void dynamic_switch_emulator_id(unsigned index)
     }
     else {
         Player &new_player = *::player[(unsigned)new_id.player];
+        ::player_inactive_since[(unsigned)old_id.player] = stc::steady_clock::now();
         new_player.set_emulator(new_id.emulator);
         new_player.set_chip_count(player.chip_count());
         // transmit bank change and program change events
         for (unsigned channel = 0; channel < 16; ++channel) {
-            new_player.rt_bank_change_msb(channel, channel_map[channel].bank_msb);
-            new_player.rt_bank_change_lsb(channel, channel_map[channel].bank_lsb);
-            new_player.rt_program_change(channel, channel_map[channel].gm);
+            const Program &pgm = snapshot.program[channel];
+            new_player.rt_bank_change_msb(channel, pgm.bank_msb);
+            new_player.rt_bank_change_lsb(channel, pgm.bank_lsb);
+            new_player.rt_program_change(channel, pgm.gm);
         }
     }
 
     ::active_emulator_id = index;
+    return true;
+}
+
+bool dynamic_switch_chip_count(unsigned nchip)
+{
+    if (nchip == active_chip_count())
+        return true;
+    if (player_switch_busy())
+        return false;
+    if (::shard_mode) {
+        // the count is the total, shared between the shards
+        if (nchip < ::layer_count)
+            return false;
+        bool success = true;
+        for (unsigned i = 0; i < ::layer_count; ++i) {
+            unsigned shard_nchip = shard_chip_count(nchip, i, ::layer_count);
+            success = ::layer_jobs[i].player->dynamic_set_chip_count(shard_nchip) && success;
+        }
+        return success;
+    }
+    if (::layer_count)
+        return active_player().dynamic_set_chip_count(nchip);
+
+    // allocate the chips on the side, the active player keeps playing
+    Emulator_Id id = emulator_ids[active_emulator_id];
+    std::unique_ptr<Player> player = create_player(id.player);
+    if (!player || !player->set_emulator(id.emulator) ||
+        !player->set_chip_count(nchip))
+        return false;
+
+    return switch_player(std::move(player), active_emulator_id, crossfade_frames(chip_count_crossfade_ms));
+}
+
+void scale_chip_count(stc::steady_clock::time_point &deadline)
+{
+    static stc::steady_clock::time_point next_check;
+    static stc::steady_clock::time_point low_since;
+    static bool low = false;
+
+    if (::arg_nchip_max == 0 || !have_active_player() || player_switch_busy() || ::layer_count)
+        return;
+    // without measurements, hold the current count
+    if (::freewheeling.load()) {
+        low = false;
+        return;
+    }
+
+    stc::steady_clock::time_point now = stc::steady_clock::now();
+    if (now < next_check) {
+        deadline = std::min(deadline, next_check);
+        return;
+    }
+    next_check = now + stc::duration_cast<stc::steady_clock::duration>(
+        stc::duration<double>(chip_scaling_interval));
+    deadline = std::min(deadline, next_check);
+
+    double pressure = 1e-3 * ::voice_pressure_peak.exchange(0, std::memory_order_relaxed);
+    unsigned nchip = active_player().chip_count();
+
+    if (pressure >= chip_scaling_grow_pressure) {
+        low = false;
+        // the governor has removed chips, do not add them back
+        if (!::governor_steps.empty())
+            return;
+        // the cost of generation grows with the chips
+        Audio_Snapshot snapshot;
+        read_audio_snapshot(snapshot);
+        double cpu = snapshot.cpuratio * (nchip + 1) / nchip;
+        if (nchip < ::arg_nchip_max && cpu < chip_scaling_grow_cpu) {
+            debug_printf("Voices are full, using %u chips.", nchip + 1);
+            dynamic_switch_chip_count(nchip + 1);
+        }
+        return;
+    }
+
+    // the pressure, if the same voices were on one chip less
+    bool fits = nchip > ::arg_nchip &&
+        pressure * nchip / (nchip - 1) < chip_scaling_shrink_pressure;
+    if (!fits) {
+        low = false;
+        return;
+    }
+    if (!low) {
+        low = true;
+        low_since = now;
+    }
+    if (now - low_since >= stc::duration<double>(chip_scaling_shrink_delay)) {
+        low = false;
+        debug_printf("Voices are mostly free, using %u chips.", nchip - 1);
+        dynamic_switch_chip_count(nchip - 1);
+    }
+}
+
+// the emulator of the same player which is the next cheaper, or -1
+static unsigned cheaper_emulator_id(unsigned index)
+{
+    const Emulator_Id &id = emulator_ids[index];
+    unsigned cost = emulator_cost(id);
+    unsigned best = (unsigned)-1;
+    unsigned best_cost = 0;
+    for (unsigned i = 0, n = emulator_ids.size(); i < n; ++i) {
+        const Emulator_Id &other = emulator_ids[i];
+        unsigned other_cost = emulator_cost(other);
+        if (other.player != id.player || other_cost == 0 || other_cost >= cost)
+            continue;
+        if (other_cost > best_cost) {
+            best = i;
+            best_cost = other_cost;
+        }
+    }
+    return best;
+}
+
+static void set_soft_pan(bool enable)
+{
+    ::soft_pan_enabled = enable;
+    Player &player = active_player();
+    auto lock = player.take_lock();
+    player.set_soft_pan_enabled(enable);
+}
+
+// the governor changes the emulator while notes play, so always with a
+// crossfade, as the switch at once would cut them
+static bool governor_switch_emulator_id(unsigned index)
+{
+    if (index == ::active_emulator_id)
+        return true;
+    if (player_switch_busy())
+        return false;
+    unsigned fade_ms = ::arg_crossfade_ms ? ::arg_crossfade_ms : governor_crossfade_ms;
+    return crossfade_switch_emulator_id(index, fade_ms);
+}
+
+static bool apply_governor_step()
+{
+    Player &player = active_player();
+    Governor_Step step;
+
+    unsigned cheaper = cheaper_emulator_id(::active_emulator_id);
+    if (cheaper != (unsigned)-1) {
+        step = Governor_Step{Governor_Emulator, ::active_emulator_id};
+        if (!governor_switch_emulator_id(cheaper))
+            return false;
+        debug_printf("Processor overloaded, switching to emulator %u.", cheaper);
+    }
+    else if (player.chip_count() > 1) {
+        step = Governor_Step{Governor_Chips, player.chip_count()};
+        if (!dynamic_switch_chip_count(step.previous - 1))
+            return false;
+        debug_printf("Processor overloaded, using %u chips.", step.previous - 1);
+    }
+    else if (::soft_pan_enabled) {
+        step = Governor_Step{Governor_Soft_Pan, 1};
+        set_soft_pan(false);
+        debug_printf("Processor overloaded, disabling soft panning.");
+    }
+    else
+        return false;
+
+    ::governor_steps.push_back(step);
+    return true;
+}
+
+static bool undo_governor_step()
+{
+    const Governor_Step &step = ::governor_steps.back();
+    switch (step.kind) {
+    case Governor_Emulator:
+        if (!governor_switch_emulator_id(step.previous))
+            return false;
+        debug_printf("Processor load is low, restoring emulator %u.", step.previous);
+        break;
+    case Governor_Chips:
+        if (!dynamic_switch_chip_count(step.previous))
+            return false;
+        debug_printf("Processor load is low, using %u chips.", step.previous);
+        break;
+    case Governor_Soft_Pan:
+        set_soft_pan(step.previous);
+        debug_printf("Processor load is low, enabling soft panning.");
+        break;
+    }
+    ::governor_steps.pop_back();
+    return true;
+}
+
+void govern_cpu_load(stc::steady_clock::time_point &deadline)
+{
+    static stc::steady_clock::time_point next_check;
+    static stc::steady_clock::time_point low_since;
+    static bool low = false;
+
+    if (::arg_governor_high == 0 || !have_active_player() || player_switch_busy() || ::layer_count)
+        return;
+    if (::freewheeling.load()) {
+        low = false;
+        return;
+    }
+
+    stc::steady_clock::time_point now = stc::steady_clock::now();
+    if (now < next_check) {
+        deadline = std::min(deadline, next_check);
+        return;
+    }
+    next_check = now + stc::duration_cast<stc::steady_clock::duration>(
+        stc::duration<double>(governor_interval));
+    deadline = std::min(deadline, next_check);
+
+    unsigned counts[callback_cost_buckets];
+    unsigned total = 0;
+    for (unsigned i = 0; i < callback_cost_buckets; ++i) {
+        counts[i] = ::callback_cost_histogram[i].exchange(0, std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0)
+        return;
+
+    // the upper bound of the bucket which contains the percentile
+    unsigned rank = (unsigned)std::ceil(governor_percentile * total);
+    unsigned bucket = 0;
+    for (unsigned sum = counts[0]; sum < rank; sum += counts[++bucket]);
+    double cost = (bucket + 1) * callback_cost_bucket_width;
+
+    if (cost > ::arg_governor_high * 1e-2) {
+        low = false;
+        apply_governor_step();
+        return;
+    }
+
+    if (cost >= ::arg_governor_low * 1e-2 || ::governor_steps.empty()) {
+        low = false;
+        return;
+    }
+    if (!low) {
+        low = true;
+        low_since = now;
+    }
+    if (now - low_since >= stc::duration<double>(governor_restore_delay)) {
+        low = false;
+        undo_governor_step();
+    }
+}
+
+// the shards play the bank of the active player
+static void update_shard_banks(Player &player, const std::shared_ptr<const Bank> &bank)
+{
+    if (!::shard_mode || &player != &active_player())
+        return;
+    for (const std::unique_ptr<Player> &shard : ::shard_players)
+        dynamic_update_bank(*shard, bank);
+}
+
+bool dynamic_update_bank(Player &player, const std::shared_ptr<const Bank> &bank, Bank_Update *update)
+{
+    if (update)
+        *update = Bank_Update();
+
+    std::vector<Bank_Change> changes;
+    const std::shared_ptr<const Bank> &current = player.bank();
+    if (!current || !diff_banks(*current, *bank, changes)) {
+        if (!player.dynamic_load_bank(bank))
+            return false;
+        update_shard_banks(player, bank);
+        return true;
+    }
+
+    auto lock = player.take_lock();
+
+    bool percussion_changed = false;
+    std::bitset<128> melodic_changed;
+    for (const Bank_Change &change : changes) {
+        const Player::Bank_Id &id = bank->bank_id(change.bank);
+        if (!player.set_instrument(id, change.index, bank->instrument(change.bank, change.index))) {
+            player.panic();
+            return player.load_bank(bank);
+        }
+        if (id.percussive)
+            percussion_changed = true;
+        else
+            melodic_changed.set(change.index);
+    }
+
+    // all sound off, on the channels set to a program which was replaced.
+    // the programs come from the snapshot, the audio side owns the tables.
+    // the held notes are not checked, the snapshot may predate the latest.
+    Audio_Snapshot snapshot;
+    read_audio_snapshot(snapshot);
+    for (unsigned channel = 0; channel < 16; ++channel) {
+        bool changed = (channel == 9) ? percussion_changed :
+            melodic_changed.test(snapshot.program[channel].gm);
+        if (changed)
+            player.rt_controller_change(channel, 120, 0);
+    }
+
+    player.set_loaded_bank(bank);
+
+    if (update) {
+        update->incremental = true;
+        update->instruments = changes.size();
+    }
+
+    update_shard_banks(player, bank);
+    return true;
 }
 
 //------------------------------------------------------------------------------
@@ -473,8 +1999,11 @@ static void print_volume_bar(FILE *out, unsigned size, double vol)
     fprintf(out, "]");
 }
 
-static void simple_interface_exec(void(*idle_proc)(void *), void *idle_data)
+static void simple_interface_exec(void(*idle_proc)(void *), void *idle_data, int idle_fd)
 {
+    const stc::nanoseconds frame_interval = stc::nanoseconds(1000000000 / ::arg_ui_fps);
+    Audio_Snapshot snapshot;
+
     while (1) {
         if (interface_interrupted()) {
             fprintf(stderr, "%s\n", _("Interrupted."));
@@ -484,8 +2013,15 @@ static void simple_interface_exec(void(*idle_proc)(void *), void *idle_data)
         if (idle_proc)
             idle_proc(idle_data);
 
+        finish_player_switch();
+        stc::steady_clock::time_point deadline = stc::steady_clock::time_point::max();
+        release_inactive_players(deadline);
+        scale_chip_count(deadline);
+        govern_cpu_load(deadline);
+
         fprintf(stderr, "\033[2K");
-        double volumes[2] = {lvcurrent[0], lvcurrent[1]};
+        read_audio_snapshot(snapshot);
+        double volumes[2] = {snapshot.lvcurrent[0], snapshot.lvcurrent[1]};
         const char *names[2] = {"Left", "Right"};
 
         // enables logarithmic view for perceptual volume, otherwise linear.
@@ -507,19 +2043,32 @@ static void simple_interface_exec(void(*idle_proc)(void *), void *idle_data)
         fprintf(stderr, "\r");
         fflush(stderr);
 
-        std::this_thread::sleep_for(stc::milliseconds(50));
+#if !defined(_WIN32)
+        if (idle_fd != -1) {
+            pollfd pfd = {};
+            pfd.fd = idle_fd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, stc::duration_cast<stc::milliseconds>(frame_interval).count());
+            continue;
+        }
+#endif
+        std::this_thread::sleep_for(frame_interval);
     }
 }
 
-void interface_exec(void(*idle_proc)(void *), void *idle_data)
+void interface_exec(void(*idle_proc)(void *), void *idle_data, int idle_fd)
 {
+    if (arg_daemon) {
+        daemon_interface_exec(idle_proc, idle_data, idle_fd);
+        return;
+    }
 #if defined(ADLJACK_USE_CURSES)
     if (arg_simple_interface)
-        simple_interface_exec(idle_proc, idle_data);
+        simple_interface_exec(idle_proc, idle_data, idle_fd);
     else
-        curses_interface_exec(idle_proc, idle_data);
+        curses_interface_exec(idle_proc, idle_data, idle_fd);
 #else
-    simple_interface_exec();
+    simple_interface_exec(idle_proc, idle_data, idle_fd);
 #endif
 }
 
@@ -543,7 +2092,7 @@ void handle_signals()
         if (!sigismember(&sigs, sig))
             continue;
         struct sigaction sa = {};
-        sa.sa_handler = +[](int) { ::interrupted_by_signal = 1; };
+        sa.sa_handler = +[](int) { ::interrupted_by_signal = 1; wakeup_interface(); };
         sa.sa_mask = sigs;
         if (sigaction(sig, &sa, nullptr) == -1)
             throw std::system_error(errno, std::generic_category(), "sigaction");
@@ -557,6 +2106,18 @@ void handle_signals()
 #endif
 }
 
+void set_freewheel(bool enable)
+{
+    ::freewheeling.store(enable);
+    wakeup_interface();
+}
+
+void set_render_priority(int priority)
+{
+    if (::render_pool && !::render_pool->set_priority(priority))
+        debug_printf("Error setting the priority of the render threads.");
+}
+
 bool interface_interrupted()
 {
     return ::interrupted_by_signal;
@@ -7,19 +7,24 @@
 #include "player.h"
 #include "dcfilter.h"
 #include "vumonitor.h"
+#include "notification_bus.h"
 #include <ring_buffer/ring_buffer.h>
 #include <getopt.h>
 #include <string>
 #include <bitset>
 #include <memory>
+#include <chrono>
 #include <adlmidi.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
 
+class Bank_Cache;
+
 extern std::unique_ptr<Player> player[player_type_count];
 extern std::string player_bank_file[player_type_count];
+extern std::unique_ptr<Bank_Cache> bank_cache;
 
 struct Emulator_Id {
     Emulator_Id()
@@ -48,14 +53,14 @@ inline unsigned active_player_index()
     { return (unsigned)emulator_ids[::active_emulator_id].player; }
 inline Player &active_player()
     { return *::player[active_player_index()]; }
+inline bool have_player(Player_Type pt)
+    { return ::player[(unsigned)pt] != nullptr; }
 inline std::string &active_bank_file()
     { return ::player_bank_file[active_player_index()]; }
 
 extern int player_volume;
 extern DcFilter dcfilter[2];
 extern VuMonitor lvmonitor[2];
-extern double lvcurrent[2];
-extern double cpuratio;
 static constexpr double dccutoff = 5.0;
 static constexpr double lvrelease = 20e-3;
 
@@ -67,35 +72,84 @@ struct Program {
     unsigned bank_msb = 0;
     unsigned bank_lsb = 0;
 };
-extern Program channel_map[16];
-
-extern unsigned midi_channel_note_count[16];
-extern std::bitset<128> midi_channel_note_active[16];
-extern unsigned midi_channel_last_note_p1[16];
-
-extern std::unique_ptr<Ring_Buffer> fifo_notify;
-static constexpr unsigned fifo_notify_size = 8192;
+// the state of the audio side which the interface displays. the audio
+// thread publishes it periodically, and when a program changes.
+struct Audio_Snapshot {
+    double lvcurrent[2] = {};
+    // the highest cost of the blocks since the previous snapshot, relative
+    // to their period
+    double cpuratio = 0;
+    Program program[16];
+    unsigned note_count[16] = {};
+    std::bitset<128> note_active[16];
+    unsigned last_note_p1[16] = {};
+};
 
-enum Notification_Type {
-    Notify_TextInsert,
-    Notify_Channels,
+// copy the last snapshot, from any thread, and get its number, which
+// increases with every publication
+unsigned long read_audio_snapshot(Audio_Snapshot &snapshot);
+
+// the controls of a channel, which are replayed into a player taking over
+struct Channel_Controls {
+    Channel_Controls();
+    // record a controller, other than the channel mode messages
+    void controller_change(unsigned cc, unsigned val);
+    // bring a player to these controls, except the bank select and the notes
+    void replay(Player &player, unsigned channel) const;
+    uint8_t controller[120];  // 0xff if never received
+    uint8_t note_velocity[128];
+    unsigned pitchbend = 8192;
+    unsigned aftertouch = 0;
+    // whether the last selected parameter is registered (RPN) or not (NRPN)
+    bool registered_parameter = true;
 };
-struct Notify_Header {
-    Notification_Type type;
-    unsigned size;
+extern Channel_Controls channel_controls[16];
+
+// in layer mode, the gain of the output of each player which receives the
+// channel, or 0 if the player does not receive it
+struct Channel_Route {
+    float gain[player_type_count] = {};
 };
+extern Channel_Route channel_routes[16];
+
+// the events and the states which the audio side posts for the consumers
+static constexpr unsigned notification_bus_capacity = 64;
+extern Notification_Bus notification_bus;
 
-bool notify(Notification_Type type, const uint8_t *data, unsigned len);
+// request the description of the voices in the Notify_Channels slot, for
+// when a view displays it. every request is withdrawn with `false`.
+void set_channel_description(bool enable);
+
+// the audio side signals the interface when it has something new to show,
+// by making the wakeup descriptor readable. (-1 if unsupported)
+// it is signaled at most once until the interface acknowledges it.
+void wakeup_interface();
+int interface_wakeup_fd();
+void acknowledge_interface_wakeup();
 
 static constexpr unsigned default_nchip = 2;
+static constexpr unsigned default_ui_fps = 20;
 static constexpr unsigned midi_message_max_size = 64;
 static constexpr unsigned midi_buffer_size = 64 * 1024;
 
 extern Player_Type arg_player_type;
 extern unsigned arg_nchip;
+extern unsigned arg_nchip_max;
 extern const char *arg_bankfile;
 extern unsigned arg_emulator;
 extern bool arg_autoconnect;
+extern unsigned arg_ui_fps;
+extern std::vector<const char *> arg_preload_banks;
+extern size_t arg_bank_cache_budget;
+extern bool arg_shared_banks;
+extern unsigned arg_player_timeout;
+extern unsigned arg_crossfade_ms;
+extern unsigned arg_governor_high;
+extern unsigned arg_governor_low;
+extern bool arg_calibrate;
+extern bool arg_layer;
+extern bool arg_daemon;
+extern const char *arg_control_socket;
 #if defined(ADLJACK_USE_CURSES)
 extern bool arg_simple_interface;
 #endif
@@ -103,15 +157,82 @@ extern bool arg_simple_interface;
 void generic_usage(const char *progname, const char *more_options);
 int generic_getopt(int argc, char *argv[], const char *more_options, void(&usagefn)());
 
-bool initialize_player(Player_Type pt, unsigned sample_rate, unsigned nchip, const char *bankfile, unsigned emulator, bool quiet = false);
+// with several outputs, each plays a group of channels with its own player
+bool initialize_player(Player_Type pt, unsigned sample_rate, unsigned nchip, const char *bankfile, unsigned emulator, bool quiet = false, unsigned noutputs = 1);
 void player_ready(bool quiet = false);
+// on the audio side, queue an event for the next call to generate outputs
 void play_midi(const uint8_t *msg, unsigned len);
 void play_sysex(const uint8_t *msg, unsigned len);
+// from one thread besides the audio, queue a message which the audio side
+// plays at its next block. false if the queue is full.
+bool queue_midi(const uint8_t *msg, unsigned len);
 void generate_outputs(float *left, float *right, unsigned nframes, unsigned stride);
+void generate_multi_outputs(float *const left[], float *const right[], unsigned noutputs, unsigned nframes);
+static constexpr unsigned outputs_max = 16;
+// when rendering faster than real time, skip the measurements of the output
+// and the updates of the interface, which also hold the automatic changes
+void set_freewheel(bool enable);
+// give the threads which render the layers the priority of the audio thread
+void set_render_priority(int priority);
+
+// get the player of the given type, creating it on first use.
+// a new player has its bank loaded, and receives the channel programs.
+Player *instantiate_player(Player_Type pt);
+// free the players which were inactive for longer than the timeout,
+// and schedule the next check before the deadline
+void release_inactive_players(std::chrono::steady_clock::time_point &deadline);
+
+// switch emulator, with a crossfade if enabled, otherwise at once.
+// false if it fails, or if another switch is under way.
+bool dynamic_switch_emulator_id(unsigned index);
+
+// the number of chips of the active player, or with several outputs, the
+// total of the shards
+unsigned active_chip_count();
+// set the chips of a player which is not playing, or whose lock is held.
+// the active player with several outputs shares them with the shards.
+bool set_active_chip_count(Player &player, unsigned nchip);
+
+// change the number of chips by switching to a player which has them,
+// so the notes keep playing. false if it fails, or if a switch is under way.
+bool dynamic_switch_chip_count(unsigned nchip);
+
+// with a range of chips, add a chip when the voices are all busy, and
+// remove one when the others suffice for a while.
+// schedule the next check before the deadline.
+void scale_chip_count(std::chrono::steady_clock::time_point &deadline);
+
+// when the processing cost of the audio gets near the period, apply the
+// degradations one after another: a cheaper emulator, less chips, no soft
+// panning. undo them in reverse when the cost goes down again.
+// schedule the next check before the deadline.
+void govern_cpu_load(std::chrono::steady_clock::time_point &deadline);
+
+// replace the active player by a prepared one, which takes over on the audio
+// thread at the next block after receiving the state of the channels.
+// both players play during the fade, if the number of frames is not zero.
+// false if another switch is under way.
+bool switch_player(std::unique_ptr<Player> player, unsigned emulator_index, unsigned fade_frames);
+bool player_switch_busy();
+// on the interface side, after the audio has switched, delete the old player
+void finish_player_switch();
+
+// load the default bank, unless it is loaded already
+bool load_default_bank(Player &player);
+
+struct Bank_Update {
+    // whether only the changed instruments were replaced
+    bool incremental = false;
+    unsigned instruments = 0;
+};
 
-void dynamic_switch_emulator_id(unsigned index);
+// load a bank, or if it is a new version of the current one, replace the
+// instruments which differ and silence only the channels which use them.
+bool dynamic_update_bank(Player &player, const std::shared_ptr<const Bank> &bank, Bank_Update *update = nullptr);
 
-void interface_exec(void(*idle_proc)(void *), void *idle_data);
+// the idle procedure runs whenever `idle_fd` becomes readable,
+//  or periodically when there is no such descriptor
+void interface_exec(void(*idle_proc)(void *), void *idle_data, int idle_fd = -1);
 
 void handle_signals();
 bool interface_interrupted();
@@ -0,0 +1,287 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "control_socket.h"
+#if !defined(_WIN32)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <errno.h>
+
+#if !defined(_WIN32) && !defined(MSG_NOSIGNAL)
+#   define MSG_NOSIGNAL 0
+#endif
+
+static constexpr unsigned control_clients_max = 16;
+static constexpr unsigned control_wake_max = 4;
+static constexpr size_t control_line_max = 4096;
+
+struct Control_Client {
+    int fd = -1;
+    std::string input;
+};
+
+struct Control_Socket::Impl {
+    Handler handler;
+    std::string path;
+    int fd = -1;
+    std::vector<Control_Client> clients;
+
+    void accept_client();
+    // false if the client is to be disconnected
+    bool receive(Control_Client &client);
+    bool execute(Control_Client &client, const std::string &line);
+};
+
+Control_Socket::Control_Socket(Handler handler)
+    : P(new Impl)
+{
+    P->handler = std::move(handler);
+}
+
+Control_Socket::~Control_Socket()
+{
+    close();
+}
+
+const std::string &Control_Socket::path() const
+{
+    return P->path;
+}
+
+#if !defined(_WIN32)
+static std::vector<std::string> split_command(const std::string &line)
+{
+    std::vector<std::string> args;
+    size_t i = 0, n = line.size();
+    for (;;) {
+        while (i < n && (line[i] == ' ' || line[i] == '\t'))
+            ++i;
+        if (i == n)
+            break;
+        std::string arg;
+        if (line[i] == '"') {
+            for (++i; i < n && line[i] != '"'; ++i) {
+                if (line[i] == '\\' && i + 1 < n)
+                    ++i;
+                arg.push_back(line[i]);
+            }
+            i += (i < n);
+        }
+        else {
+            for (; i < n && line[i] != ' ' && line[i] != '\t'; ++i)
+                arg.push_back(line[i]);
+        }
+        args.push_back(std::move(arg));
+    }
+    return args;
+}
+
+bool Control_Socket::open(const char *path)
+{
+    close();
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return false;
+
+    // a socket which nobody listens on is left over from a previous run.
+    // anything else at the path is not ours to remove.
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0) {
+        ::close(fd);
+        errno = EADDRINUSE;
+        return false;
+    }
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            ::close(fd);
+            errno = EEXIST;
+            return false;
+        }
+        unlink(path);
+    }
+
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) == -1 ||
+        chmod(path, 0600) == -1 || listen(fd, 4) == -1 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+    {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return false;
+    }
+
+    P->fd = fd;
+    P->path = path;
+    return true;
+}
+
+void Control_Socket::close()
+{
+    for (Control_Client &client : P->clients)
+        ::close(client.fd);
+    P->clients.clear();
+    if (P->fd != -1) {
+        ::close(P->fd);
+        unlink(P->path.c_str());
+        P->fd = -1;
+        P->path.clear();
+    }
+}
+
+bool Control_Socket::wait(int timeout_ms, const int wake_fds[], unsigned nwake)
+{
+    std::vector<Control_Client> &clients = P->clients;
+    nwake = std::min(nwake, control_wake_max);
+
+    pollfd fds[1 + control_wake_max + control_clients_max];
+    unsigned nfds = 0;
+    fds[nfds++] = pollfd{P->fd, POLLIN, 0};
+    for (unsigned i = 0; i < nwake; ++i)
+        fds[nfds++] = pollfd{wake_fds[i], POLLIN, 0};
+    for (const Control_Client &client : clients)
+        fds[nfds++] = pollfd{client.fd, POLLIN, 0};
+
+    if (poll(fds, nfds, timeout_ms) <= 0)
+        return false;
+
+    // process the clients in reverse, to remove them while iterating
+    const pollfd *client_fds = &fds[1 + nwake];
+    for (unsigned i = clients.size(); i-- > 0;) {
+        if (!client_fds[i].revents)
+            continue;
+        if (!P->receive(clients[i])) {
+            ::close(clients[i].fd);
+            clients.erase(clients.begin() + i);
+        }
+    }
+
+    if (fds[0].revents & POLLIN)
+        P->accept_client();
+
+    bool woken = false;
+    for (unsigned i = 0; i < nwake; ++i)
+        woken = woken || (fds[1 + i].revents & POLLIN);
+    return woken;
+}
+
+void Control_Socket::Impl::accept_client()
+{
+    int client_fd = accept(fd, nullptr, nullptr);
+    if (client_fd == -1)
+        return;
+    // never block the loop on a client
+    if (clients.size() == control_clients_max ||
+        fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK) == -1)
+    {
+        ::close(client_fd);
+        return;
+    }
+    Control_Client client;
+    client.fd = client_fd;
+    clients.push_back(std::move(client));
+}
+
+bool Control_Socket::Impl::receive(Control_Client &client)
+{
+    char buf[1024];
+    ssize_t count = read(client.fd, buf, sizeof(buf));
+    if (count <= 0)
+        return count == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK);
+
+    std::string &input = client.input;
+    input.append(buf, count);
+
+    size_t start = 0;
+    for (size_t end; (end = input.find('\n', start)) != input.npos; start = end + 1) {
+        std::string line = input.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!execute(client, line))
+            return false;
+    }
+    input.erase(0, start);
+
+    return input.size() < control_line_max;
+}
+
+bool Control_Socket::Impl::execute(Control_Client &client, const std::string &line)
+{
+    std::vector<std::string> args = split_command(line);
+    if (args.empty())
+        return true;
+
+    std::string reply;
+    bool success = handler(args, reply);
+
+    std::string answer;
+    if (success) {
+        answer = reply;
+        if (!answer.empty() && answer.back() != '\n')
+            answer.push_back('\n');
+        answer.append("ok\n");
+    }
+    else
+        answer = "error " + reply + "\n";
+
+    // the replies are short, and fit in the buffer of the socket unless the
+    // client stopped reading them. such a client is dropped.
+    for (size_t i = 0, n = answer.size(); i < n;) {
+        ssize_t count = send(client.fd, &answer[i], n - i, MSG_NOSIGNAL);
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        i += count;
+    }
+    return true;
+}
+
+std::string Control_Socket::default_path(const char *name)
+{
+    std::string path;
+    if (const char *runtime = getenv("XDG_RUNTIME_DIR"))
+        path = std::string(runtime) + "/" + name;
+    else
+        path = "/tmp/" + std::string(name) + "-" + std::to_string(getuid());
+    return path + ".sock";
+}
+#else
+bool Control_Socket::open(const char *)
+{
+    return false;
+}
+
+void Control_Socket::close()
+{
+}
+
+bool Control_Socket::wait(int, const int[], unsigned)
+{
+    return false;
+}
+
+std::string Control_Socket::default_path(const char *)
+{
+    return std::string();
+}
+#endif
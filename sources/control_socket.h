@@ -0,0 +1,44 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include <memory>
+
+// A UNIX socket which accepts commands, one per line. The words of a
+// command are separated by spaces, and a word can be quoted with double
+// quotes. Every command is answered with its output, if any, followed by a
+// line "ok", or a line "error" and the reason.
+// The commands are processed on the thread which waits on the socket.
+class Control_Socket {
+public:
+    // process a command, and write the output into `reply`, or the reason
+    // of the error if it fails
+    typedef std::function<bool(const std::vector<std::string> &args, std::string &reply)> Handler;
+
+    explicit Control_Socket(Handler handler);
+    ~Control_Socket();
+
+    // listen on the path, replacing a socket left there by a process which
+    // did not clean it up. it fails if the path is another kind of file.
+    bool open(const char *path);
+    void close();
+    const std::string &path() const;
+
+    // wait for the commands, and process them. it returns after the
+    // timeout in milliseconds (-1 for none), or when one of the wake
+    // descriptors becomes readable, in which case the result is true.
+    // (at most 4 of them, and -1 is ignored)
+    bool wait(int timeout_ms, const int wake_fds[] = nullptr, unsigned nwake = 0);
+
+    // the socket of the name in the runtime directory of the user
+    static std::string default_path(const char *name);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> P;
+};
@@ -0,0 +1,224 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "daemon.h"
+#include "control_socket.h"
+#include "common.h"
+#include "bank_cache.h"
+#include "i18n.h"
+#if defined(ADLJACK_USE_NSM)
+#include "state.h"
+#endif
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+namespace stc = std::chrono;
+
+static const char daemon_help[] =
+    "bank <file>: load a bank into the active player\n"
+    "emulator <index>: switch to an emulator of the status list\n"
+    "chips <count>: change the number of chips\n"
+    "volume <percent>: set the output volume\n"
+    "panic: silence all the notes\n"
+    "save <file>: save the state into a file\n"
+    "status: show the state of the synthesizer\n"
+    "help: show this message\n";
+
+static bool parse_unsigned(const std::string &text, unsigned &value)
+{
+    char *end;
+    unsigned long number = strtoul(text.c_str(), &end, 10);
+    if (text.empty() || text[0] == '-' || *end != '\0' || number > ~0u)
+        return false;
+    value = number;
+    return true;
+}
+
+// the emulator ids of a player can be sparse
+static const char *emulator_name(const Emulator_Id &id)
+{
+    for (const Player::Emulator &e : Player::enumerate_emulators(id.player)) {
+        if (e.id == id.emulator)
+            return e.name;
+    }
+    return "";
+}
+
+static void daemon_status(std::string &reply)
+{
+    char line[256];
+    Player &player = active_player();
+
+    snprintf(line, sizeof(line), "player %s\n", Player::name(player.type()));
+    reply.append(line);
+    for (unsigned i = 0, n = ::emulator_ids.size(); i < n; ++i) {
+        const Emulator_Id &id = ::emulator_ids[i];
+        snprintf(line, sizeof(line), "emulator %u %s %s%s\n", i,
+                 Player::name(id.player), emulator_name(id), (i == ::active_emulator_id) ? " *" : "");
+        reply.append(line);
+    }
+    snprintf(line, sizeof(line), "chips %u\n", active_chip_count());
+    reply.append(line);
+    snprintf(line, sizeof(line), "volume %d\n", ::player_volume);
+    reply.append(line);
+    reply.append("bank ");
+    const std::string &bank_file = active_bank_file();
+    reply.append(bank_file.empty() ? "(embedded)" : bank_file);
+    reply.push_back('\n');
+    Audio_Snapshot snapshot;
+    read_audio_snapshot(snapshot);
+    snprintf(line, sizeof(line), "cpu %.1f\n", 100 * snapshot.cpuratio);
+    reply.append(line);
+    snprintf(line, sizeof(line), "level %.3f %.3f\n", snapshot.lvcurrent[0], snapshot.lvcurrent[1]);
+    reply.append(line);
+}
+
+static bool daemon_save(const char *path, std::string &reply)
+{
+#if defined(ADLJACK_USE_NSM)
+    std::vector<uint8_t> data;
+    if (!save_state(data)) {
+        reply = "cannot save the state";
+        return false;
+    }
+    FILE_u stream(fopen(path, "wb"));
+    if (!stream || fwrite(data.data(), 1, data.size(), stream.get()) != data.size() ||
+        fflush(stream.get()) != 0) {
+        reply = strerror(errno);
+        return false;
+    }
+    return true;
+#else
+    (void)path;
+    reply = "not supported";
+    return false;
+#endif
+}
+
+// the commands apply the same way as the keys of the terminal interface
+static bool daemon_command(const std::vector<std::string> &args, std::string &reply)
+{
+    const std::string &cmd = args[0];
+    unsigned argc = args.size() - 1;
+    unsigned value;
+
+    if (cmd == "help" && argc == 0) {
+        reply = daemon_help;
+        return true;
+    }
+
+    if (!have_active_player()) {
+        reply = "no player";
+        return false;
+    }
+    Player &player = active_player();
+
+    if (cmd == "status" && argc == 0) {
+        daemon_status(reply);
+        return true;
+    }
+    else if (cmd == "bank" && argc == 1) {
+        const char *path = args[1].c_str();
+        std::shared_ptr<const Bank> bank = ::bank_cache->load(player.type(), path);
+        if (!bank || !dynamic_update_bank(player, bank)) {
+            reply = "cannot load the bank";
+            return false;
+        }
+        active_bank_file() = path;
+        return true;
+    }
+    else if (cmd == "emulator" && argc == 1) {
+        if (!parse_unsigned(args[1], value) || value >= ::emulator_ids.size()) {
+            reply = "invalid emulator";
+            return false;
+        }
+        if (value != ::active_emulator_id && !dynamic_switch_emulator_id(value)) {
+            reply = "busy";
+            return false;
+        }
+        return true;
+    }
+    else if (cmd == "chips" && argc == 1) {
+        if (!parse_unsigned(args[1], value) || value < 1 || value > player_max_chips) {
+            reply = "invalid chip count";
+            return false;
+        }
+        if (value != active_chip_count() && !dynamic_switch_chip_count(value)) {
+            reply = "busy";
+            return false;
+        }
+        return true;
+    }
+    else if (cmd == "volume" && argc == 1) {
+        if (!parse_unsigned(args[1], value) || (int)value > volume_max) {
+            reply = "invalid volume";
+            return false;
+        }
+        ::player_volume = std::max(volume_min, (int)value);
+        return true;
+    }
+    else if (cmd == "panic" && argc == 0) {
+        player.dynamic_panic();
+        return true;
+    }
+    else if (cmd == "save" && argc == 1)
+        return daemon_save(args[1].c_str(), reply);
+
+    reply = "unknown command";
+    return false;
+}
+
+void daemon_interface_exec(void (*idle_proc)(void *), void *idle_data, int idle_fd)
+{
+    Control_Socket control(&daemon_command);
+    std::string path = ::arg_control_socket ? std::string(::arg_control_socket) :
+        Control_Socket::default_path("adljack");
+    if (!control.open(path.c_str())) {
+        fprintf(stderr, _("Cannot open the control socket %s: %s\n"), path.c_str(), strerror(errno));
+        return;
+    }
+    fprintf(stderr, _("Listening on %s\n"), path.c_str());
+
+    const int wake_fds[] = {interface_wakeup_fd(), idle_fd};
+    Notification_Bus::Cursor cursor = ::notification_bus.subscribe();
+
+    for (;;) {
+        acknowledge_interface_wakeup();
+        if (interface_interrupted()) {
+            fprintf(stderr, "%s\n", _("Interrupted."));
+            break;
+        }
+
+        // log the events, there is no display for them
+        Notification_Event event;
+        unsigned long lost = 0;
+        while (::notification_bus.next(cursor, event, &lost)) {
+            if (lost)
+                debug_printf("Lost %lu notifications.", lost);
+            if (event.type == Notify_TextInsert)
+                debug_printf("Text: %.*s", (int)event.size, (const char *)event.data);
+        }
+
+        if (idle_proc)
+            idle_proc(idle_data);
+
+        finish_player_switch();
+        stc::steady_clock::time_point deadline = stc::steady_clock::time_point::max();
+        release_inactive_players(deadline);
+        scale_chip_count(deadline);
+        govern_cpu_load(deadline);
+
+        // sleep until the next scheduled check, if any
+        int wait_ms = -1;
+        if (deadline != stc::steady_clock::time_point::max()) {
+            stc::steady_clock::duration left = deadline - stc::steady_clock::now();
+            wait_ms = (int)std::max<long>(0, 1 + stc::duration_cast<stc::milliseconds>(left).count());
+        }
+        control.wait(wait_ms, wake_fds, 2);
+    }
+}
@@ -0,0 +1,10 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+// run without an interface, taking the commands from a control socket.
+// it sleeps until a command arrives, a signal, or a scheduled check.
+void daemon_interface_exec(void (*idle_proc)(void *), void *idle_data, int idle_fd);
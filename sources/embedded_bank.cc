@@ -0,0 +1,59 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "bank.h"
+#include "common.h"
+
+// The embedded banks which the library does not own are packed by adlpack
+// at build time, so they are ready to use from read-only data.
+
+#if defined(ADLJACK_PACKED_EMBEDDED_BANKS)
+alignas(16) static const uint8_t opn2_packed[] = {
+    #include "embedded-banks/opn2.packed.h"
+};
+
+static std::shared_ptr<const Bank> make_embedded_bank(Player_Type pt, const uint8_t *image, size_t size)
+{
+    std::shared_ptr<Bank> bank(new Bank);
+    if (!bank->load_packed(image, size, nullptr, true) || bank->type() != pt)
+        return nullptr;
+    return bank;
+}
+
+// the bank file for the library, which is part of the packed image
+const uint8_t *Player_Traits<Player_Type::OPN2>::embedded_bank_data(unsigned bank, size_t *size)
+{
+    std::shared_ptr<const Bank> packed = embedded_bank(Player_Type::OPN2, bank);
+    if (!packed)
+        return nullptr;
+    *size = packed->size();
+    return packed->data();
+}
+#endif
+
+std::shared_ptr<const Bank> embedded_bank(Player_Type pt, unsigned index)
+{
+#if defined(ADLJACK_PACKED_EMBEDDED_BANKS)
+    if (pt == Player_Type::OPN2 && index == 0) {
+        static const std::shared_ptr<const Bank> bank =
+            make_embedded_bank(pt, opn2_packed, sizeof(opn2_packed));
+        return bank;
+    }
+#else
+    (void)pt;
+    (void)index;
+#endif
+    return nullptr;
+}
+
+bool load_default_bank(Player &player)
+{
+    std::shared_ptr<const Bank> bank = embedded_bank(player.type(), 0);
+    if (!bank)
+        return player.set_embedded_bank(0);
+    if (player.bank() == bank)
+        return true;
+    return player.load_bank(bank);
+}
@@ -8,6 +8,9 @@
 #include "insnames.h"
 #include "i18n.h"
 #include "common.h"
+#if defined(ADLJACK_USE_OSC)
+#include "osc_control.h"
+#endif
 #include <atomic>
 #include <system_error>
 #include <stdlib.h>
@@ -17,14 +20,17 @@
 #include <sys/stat.h>
 
 static std::string program_title = "ADLjack";
+static unsigned arg_outputs = 1;
+#if defined(ADLJACK_USE_OSC)
+static std::string arg_osc_address;
+static const char *arg_osc_port = nullptr;
+#endif
 
 static int process(jack_nframes_t nframes, void *user_data)
 {
     const Audio_Context &ctx = *(Audio_Context *)user_data;
 
     void *midi = jack_port_get_buffer(ctx.midiport, nframes);
-    float *left = (float *)jack_port_get_buffer(ctx.outport[0], nframes);
-    float *right = (float *)jack_port_get_buffer(ctx.outport[1], nframes);
 
     for (jack_nframes_t i = 0; i < nframes; ++i) {
         jack_midi_event_t event;
@@ -32,10 +38,30 @@ static int process(jack_nframes_t nframes, void *user_data)
             play_midi(event.buffer, event.size);
     }
 
-    generate_outputs(left, right, nframes, 1);
+    unsigned noutputs = ctx.noutputs;
+    if (noutputs == 1) {
+        float *left = (float *)jack_port_get_buffer(ctx.outport[0], nframes);
+        float *right = (float *)jack_port_get_buffer(ctx.outport[1], nframes);
+        generate_outputs(left, right, nframes, 1);
+    }
+    else {
+        // the shards render straight into the port buffers
+        float *left[outputs_max];
+        float *right[outputs_max];
+        for (unsigned i = 0; i < noutputs; ++i) {
+            left[i] = (float *)jack_port_get_buffer(ctx.outport[2 * i], nframes);
+            right[i] = (float *)jack_port_get_buffer(ctx.outport[2 * i + 1], nframes);
+        }
+        generate_multi_outputs(left, right, noutputs, nframes);
+    }
     return 0;
 }
 
+static void freewheel(int starting, void *)
+{
+    set_freewheel(starting != 0);
+}
+
 static int setup_audio(const char *client_name, Audio_Context &ctx, bool quiet = false)
 {
     jack_client_t *client(jack_client_open(client_name, JackNoStartServer, nullptr));
@@ -48,10 +74,22 @@ static int setup_audio(const char *client_name, Audio_Context &ctx, bool quiet =
     ::program_title = std::string("ADLjack") + " [" + jack_get_client_name(client) + "]";
 
     ctx.midiport = jack_port_register(client, "MIDI", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput|JackPortIsTerminal, 0);
-    ctx.outport[0] = jack_port_register(client, "left", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput|JackPortIsTerminal, 0);
-    ctx.outport[1] = jack_port_register(client, "right", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput|JackPortIsTerminal, 0);
 
-    if (!ctx.midiport || !ctx.outport[0] || !ctx.outport[1]) {
+    unsigned noutputs = ctx.noutputs = ::arg_outputs;
+    bool ports_ok = ctx.midiport != nullptr;
+    for (unsigned i = 0; i < noutputs; ++i) {
+        std::string left_name = "left";
+        std::string right_name = "right";
+        if (noutputs > 1) {
+            left_name += "_" + std::to_string(i + 1);
+            right_name += "_" + std::to_string(i + 1);
+        }
+        ctx.outport[2 * i] = jack_port_register(client, left_name.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput|JackPortIsTerminal, 0);
+        ctx.outport[2 * i + 1] = jack_port_register(client, right_name.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput|JackPortIsTerminal, 0);
+        ports_ok = ports_ok && ctx.outport[2 * i] && ctx.outport[2 * i + 1];
+    }
+
+    if (!ports_ok) {
         qfprintf(quiet, stderr, "Error creating Jack ports.\n");
         return 1;
     }
@@ -61,10 +99,14 @@ static int setup_audio(const char *client_name, Audio_Context &ctx, bool quiet =
     qfprintf(quiet, stderr, "Jack client \"%s\" fs=%u bs=%u\n",
              jack_get_client_name(client), samplerate, bufsize);
 
-    if (!initialize_player(arg_player_type, samplerate, arg_nchip, arg_bankfile, arg_emulator, quiet))
+    if (!initialize_player(arg_player_type, samplerate, arg_nchip, arg_bankfile, arg_emulator, quiet, noutputs))
         return 1;
 
+    if (jack_is_realtime(client))
+        set_render_priority(jack_client_real_time_priority(client));
+
     jack_set_process_callback(client, process, &ctx);
+    jack_set_freewheel_callback(client, freewheel, &ctx);
     return 0;
 }
 
@@ -88,16 +130,33 @@ static void auto_connect(Audio_Context &ctx)
     if (device.empty())
         return;
 
-    // connect ports
+    // connect ports, all the pairs to the same device ports
     unsigned nports = 0;
     for (const char **p = ports.get(), *port; nports < 2 && (port = *p); ++p) {
         bool is_of_device = strlen(port) > device.size() &&
             port[device.size()] == ':' &&
             !memcmp(port, device.data(), device.size());
-        if (is_of_device)
-            jack_connect(client, jack_port_name(ctx.outport[nports++]), port);
+        if (!is_of_device)
+            continue;
+        for (unsigned i = 0; i < ctx.noutputs; ++i)
+            jack_connect(client, jack_port_name(ctx.outport[2 * i + nports]), port);
+        ++nports;
+    }
+}
+
+#if defined(ADLJACK_USE_OSC)
+static bool start_osc_control(Osc_Control &osc)
+{
+    if (!::arg_osc_port)
+        return true;
+    const char *address = ::arg_osc_address.empty() ? nullptr : ::arg_osc_address.c_str();
+    if (!osc.start(address, ::arg_osc_port)) {
+        fprintf(stderr, _("Cannot start the OSC server on port %s.\n"), ::arg_osc_port);
+        return false;
     }
+    return true;
 }
+#endif
 
 #if defined(ADLJACK_USE_NSM)
 static bool session_is_open = false;
@@ -289,7 +348,7 @@ static int session_main(int argc, char *argv[], const char *url, Audio_Context &
 #else
     bool in_text_terminal = true;
 #endif
-    if (in_text_terminal && !getenv("ADLJACK_DEDICATED_XTERMINAL")) {
+    if (in_text_terminal && !::arg_daemon && !getenv("ADLJACK_DEDICATED_XTERMINAL")) {
         if (setenv("ADLJACK_DEDICATED_XTERMINAL", "1", 1) == -1 ||
             setenv("ADLJACK_SESSION_PROGNAME", argv[0], 1) == -1)
             throw std::system_error(errno, std::generic_category(), "setenv");
@@ -317,13 +376,23 @@ static int session_main(int argc, char *argv[], const char *url, Audio_Context &
     debug_printf("Announcing as %s.", progname);
     nsm_send_announce(nsm.get(), "ADLjack", "", progname);
 
+#if defined(ADLJACK_USE_OSC)
+    Osc_Control osc;
+    if (!start_osc_control(osc))
+        return 1;
+    ctx.osc = &osc;
+#endif
+
     //
     auto idle_proc =
         [](void *user_data) {
             Audio_Context &ctx = *(Audio_Context *)user_data;
             nsm_check_nowait(ctx.nsm);
+#if defined(ADLJACK_USE_OSC)
+            ctx.osc->process();
+#endif
         };
-    interface_exec(+idle_proc, &ctx);
+    interface_exec(+idle_proc, &ctx, nsm_get_socket_fd(nsm.get()));
 
     //
     nsm.reset();
@@ -355,8 +424,27 @@ static int audio_main(int argc, char *argv[])
     if (::arg_autoconnect)
         auto_connect(ctx);
 
+#if defined(ADLJACK_USE_OSC)
+    Osc_Control osc;
+    if (!start_osc_control(osc)) {
+        jack_deactivate(client);
+        return 1;
+    }
+
+    //
+    auto idle_proc =
+        [](void *user_data) {
+            ((Osc_Control *)user_data)->process();
+        };
+    // the server wakes the interface after queuing a command
+    if (::arg_osc_port)
+        interface_exec(+idle_proc, &osc, interface_wakeup_fd());
+    else
+        interface_exec(nullptr, nullptr);
+#else
     //
     interface_exec(nullptr, nullptr);
+#endif
 
     //
     jack_deactivate(client);
@@ -366,7 +454,11 @@ static int audio_main(int argc, char *argv[])
 
 static void usage()
 {
-    generic_usage("adljack", "");
+#if defined(ADLJACK_USE_OSC)
+    generic_usage("adljack", " [-o outputs] [-O [address:]osc-port]");
+#else
+    generic_usage("adljack", " [-o outputs]");
+#endif
 }
 
 std::string get_program_title()
@@ -379,8 +471,35 @@ int main(int argc, char *argv[])
     i18n_setup();
     midi_db.init();
 
-    for (int c; (c = generic_getopt(argc, argv, "", usage)) != -1;) {
+#if defined(ADLJACK_USE_OSC)
+    const char *more_options = "o:O:";
+#else
+    const char *more_options = "o:";
+#endif
+
+    for (int c; (c = generic_getopt(argc, argv, more_options, usage)) != -1;) {
         switch (c) {
+        case 'o':
+            arg_outputs = std::stoi(optarg);
+            if ((int)arg_outputs < 1 || arg_outputs > outputs_max) {
+                fprintf(stderr, _("Invalid number of outputs (1-%u).\n"), outputs_max);
+                return 1;
+            }
+            break;
+#if defined(ADLJACK_USE_OSC)
+        case 'O': {
+            // the port, after an address if any
+            const char *sep = strrchr(optarg, ':');
+            if (sep) {
+                arg_osc_address.assign(optarg, sep - optarg);
+                size_t len = arg_osc_address.size();
+                if (len > 1 && arg_osc_address[0] == '[' && arg_osc_address[len - 1] == ']')
+                    arg_osc_address = arg_osc_address.substr(1, len - 2);
+            }
+            arg_osc_port = sep ? (sep + 1) : optarg;
+            break;
+        }
+#endif
         default:
             usage();
             return 1;
@@ -9,8 +9,11 @@
 #if defined(ADLJACK_USE_NSM)
 #    include <nsm.h>
 #endif
+#include "common.h"
 #include <memory>
 
+class Osc_Control;
+
 struct Jack_Deleter {
     void operator()(jack_client_t *x)
         { jack_client_close(x); }
@@ -20,10 +23,15 @@ typedef std::unique_ptr<jack_client_t, Jack_Deleter> jack_client_u;
 struct Audio_Context {
     jack_client_u client;
     jack_port_t *midiport = nullptr;
-    jack_port_t *outport[2] = {};
+    // pairs of left and right
+    jack_port_t *outport[2 * outputs_max] = {};
+    unsigned noutputs = 1;
 #if defined(ADLJACK_USE_NSM)
     nsm_client_t *nsm = nullptr;
 #endif
+#if defined(ADLJACK_USE_OSC)
+    Osc_Control *osc = nullptr;
+#endif
 };
 
 #if defined(ADLJACK_USE_NSM)
@@ -0,0 +1,336 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "lv2plugin.h"
+#include <lv2/core/lv2.h>
+#include <lv2/atom/atom.h>
+#include <lv2/atom/forge.h>
+#include <lv2/midi/midi.h>
+#include <lv2/patch/patch.h>
+#include <lv2/urid/urid.h>
+#include <lv2/worker/worker.h>
+#include <lv2/state/state.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <getopt.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Loads the plugin from its binary, plays an arpeggio through it offline,
+// and saves and restores its state into a second instance. It checks the
+// plugin without a host, and the output is written in a WAV file on demand.
+
+static constexpr unsigned sample_rate = 44100;
+static constexpr unsigned block_size = 256;
+static constexpr unsigned sequence_size = 8192;
+
+struct Host {
+    std::vector<std::string> uris;
+    LV2_URID_Map map;
+    LV2_Worker_Schedule schedule;
+    const LV2_Worker_Interface *worker = nullptr;
+    LV2_Handle instance = nullptr;
+    // the worker is run synchronously, after each block
+    std::vector<std::vector<uint8_t>> requests;
+    std::vector<std::vector<uint8_t>> responses;
+    // the properties of the saved state
+    std::map<uint32_t, std::pair<uint32_t, std::vector<uint8_t>>> state;
+};
+
+static LV2_URID host_map(LV2_URID_Map_Handle handle, const char *uri)
+{
+    Host &host = *(Host *)handle;
+    auto it = std::find(host.uris.begin(), host.uris.end(), uri);
+    if (it != host.uris.end())
+        return std::distance(host.uris.begin(), it) + 1;
+    host.uris.push_back(uri);
+    return host.uris.size();
+}
+
+static LV2_Worker_Status host_schedule_work(LV2_Worker_Schedule_Handle handle, uint32_t size, const void *data)
+{
+    Host &host = *(Host *)handle;
+    const uint8_t *bytes = (const uint8_t *)data;
+    host.requests.emplace_back(bytes, bytes + size);
+    return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status host_respond(LV2_Worker_Respond_Handle handle, uint32_t size, const void *data)
+{
+    Host &host = *(Host *)handle;
+    const uint8_t *bytes = (const uint8_t *)data;
+    host.responses.emplace_back(bytes, bytes + size);
+    return LV2_WORKER_SUCCESS;
+}
+
+static void host_run_worker(Host &host)
+{
+    if (!host.worker)
+        return;
+    while (!host.requests.empty() || !host.responses.empty()) {
+        std::vector<std::vector<uint8_t>> requests;
+        std::swap(requests, host.requests);
+        for (const std::vector<uint8_t> &request : requests)
+            host.worker->work(host.instance, &host_respond, &host, request.size(), request.data());
+        std::vector<std::vector<uint8_t>> responses;
+        std::swap(responses, host.responses);
+        for (const std::vector<uint8_t> &response : responses)
+            host.worker->work_response(host.instance, response.size(), response.data());
+    }
+}
+
+static LV2_State_Status host_store(LV2_State_Handle handle, uint32_t key, const void *value, size_t size, uint32_t type, uint32_t flags)
+{
+    Host &host = *(Host *)handle;
+    const uint8_t *bytes = (const uint8_t *)value;
+    host.state[key] = std::make_pair(type, std::vector<uint8_t>(bytes, bytes + size));
+    return LV2_STATE_SUCCESS;
+}
+
+static const void *host_retrieve(LV2_State_Handle handle, uint32_t key, size_t *size, uint32_t *type, uint32_t *flags)
+{
+    Host &host = *(Host *)handle;
+    auto it = host.state.find(key);
+    if (it == host.state.end())
+        return nullptr;
+    *size = it->second.second.size();
+    *type = it->second.first;
+    *flags = LV2_STATE_IS_POD|LV2_STATE_IS_PORTABLE;
+    return it->second.second.data();
+}
+
+struct Note {
+    unsigned frame;
+    uint8_t msg[3];
+};
+
+// an arpeggio, which starts off the boundary of a block
+static std::vector<Note> make_arpeggio(unsigned first_frame, unsigned count)
+{
+    static const unsigned keys[] = {60, 64, 67, 72};
+    const unsigned step = sample_rate / 4;
+    std::vector<Note> notes;
+    for (unsigned i = 0; i < count; ++i) {
+        unsigned key = keys[i % 4];
+        unsigned frame = first_frame + i * step;
+        notes.push_back(Note{frame, {0x90, (uint8_t)key, 100}});
+        notes.push_back(Note{frame + step * 4 / 5, {0x80, (uint8_t)key, 0}});
+    }
+    return notes;
+}
+
+static bool write_wav(const char *path, const std::vector<float> &samples)
+{
+    FILE *fh = fopen(path, "wb");
+    if (!fh)
+        return false;
+    auto u32 = [fh](uint32_t x) { uint8_t b[4] = {(uint8_t)x, (uint8_t)(x >> 8), (uint8_t)(x >> 16), (uint8_t)(x >> 24)}; fwrite(b, 4, 1, fh); };
+    auto u16 = [fh](uint16_t x) { uint8_t b[2] = {(uint8_t)x, (uint8_t)(x >> 8)}; fwrite(b, 2, 1, fh); };
+    uint32_t data_size = samples.size() * sizeof(float);
+    fwrite("RIFF", 4, 1, fh); u32(36 + data_size); fwrite("WAVE", 4, 1, fh);
+    fwrite("fmt ", 4, 1, fh); u32(16); u16(3); u16(2);
+    u32(sample_rate); u32(sample_rate * 2 * sizeof(float)); u16(2 * sizeof(float)); u16(32);
+    fwrite("data", 4, 1, fh); u32(data_size);
+    for (float x : samples) {
+        uint32_t bits;
+        memcpy(&bits, &x, 4);
+        u32(bits);
+    }
+    bool success = !ferror(fh);
+    return fclose(fh) == 0 && success;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage:\n    adljack-lv2host [-h] [-p player] [-b bankfile] [-d seconds] [-o output.wav] plugin-binary\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *player_name = "ADLMIDI";
+    const char *bankfile = nullptr;
+    const char *output = nullptr;
+    double duration = 4;
+
+    for (int c; (c = getopt(argc, argv, "hp:b:d:o:")) != -1;) {
+        switch (c) {
+        case 'p':
+            player_name = optarg; break;
+        case 'b':
+            bankfile = optarg; break;
+        case 'd':
+            duration = atof(optarg);
+            if (!(duration > 0)) {
+                fprintf(stderr, "Invalid duration.\n");
+                return 1;
+            }
+            break;
+        case 'o':
+            output = optarg; break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage();
+        return 1;
+    }
+
+    void *module = dlopen(argv[optind], RTLD_NOW|RTLD_LOCAL);
+    if (!module) {
+        fprintf(stderr, "Cannot load the plugin: %s\n", dlerror());
+        return 1;
+    }
+    LV2_Descriptor_Function get_descriptor = (LV2_Descriptor_Function)dlsym(module, "lv2_descriptor");
+    if (!get_descriptor) {
+        fprintf(stderr, "The binary is not a LV2 plugin.\n");
+        return 1;
+    }
+
+    std::string uri = std::string(ADLJACK_LV2_PREFIX) + player_name;
+    const LV2_Descriptor *desc = nullptr;
+    for (uint32_t i = 0; !desc && get_descriptor(i); ++i) {
+        if (uri == get_descriptor(i)->URI)
+            desc = get_descriptor(i);
+    }
+    if (!desc) {
+        fprintf(stderr, "The plugin %s is not in the binary.\n", uri.c_str());
+        return 1;
+    }
+
+    Host host;
+    host.map.handle = &host;
+    host.map.map = &host_map;
+    host.schedule.handle = &host;
+    host.schedule.schedule_work = &host_schedule_work;
+
+    const LV2_Feature map_feature = {LV2_URID__map, &host.map};
+    const LV2_Feature schedule_feature = {LV2_WORKER__schedule, &host.schedule};
+    const LV2_Feature *features[] = {&map_feature, &schedule_feature, nullptr};
+
+    host.instance = desc->instantiate(desc, sample_rate, "", features);
+    if (!host.instance) {
+        fprintf(stderr, "Cannot instantiate the plugin.\n");
+        return 1;
+    }
+    host.worker = (const LV2_Worker_Interface *)desc->extension_data(LV2_WORKER__interface);
+    const LV2_State_Interface *state = (const LV2_State_Interface *)desc->extension_data(LV2_STATE__interface);
+
+    alignas(8) uint8_t sequence[sequence_size];
+    float left[block_size];
+    float right[block_size];
+    float volume = 100;
+    desc->connect_port(host.instance, Lv2_Port_Control, sequence);
+    desc->connect_port(host.instance, Lv2_Port_Left, left);
+    desc->connect_port(host.instance, Lv2_Port_Right, right);
+    desc->connect_port(host.instance, Lv2_Port_Volume, &volume);
+    desc->activate(host.instance);
+
+    LV2_URID midi_MidiEvent = host_map(&host, LV2_MIDI__MidiEvent);
+    LV2_URID patch_Set = host_map(&host, LV2_PATCH__Set);
+    LV2_URID patch_property = host_map(&host, LV2_PATCH__property);
+    LV2_URID patch_value = host_map(&host, LV2_PATCH__value);
+    LV2_URID bank = host_map(&host, ADLJACK_LV2__bank);
+
+    LV2_Atom_Forge forge;
+    lv2_atom_forge_init(&forge, &host.map);
+
+    const unsigned first_frame = 1000;
+    const unsigned total_frames = duration * sample_rate;
+    std::vector<Note> notes = make_arpeggio(first_frame, duration * 4);
+    std::vector<float> samples;
+    samples.reserve(2 * total_frames);
+
+    double peak = 0;
+    unsigned onset = (unsigned)-1;
+    size_t note_index = 0;
+
+    for (unsigned frame = 0; frame < total_frames; frame += block_size) {
+        unsigned nframes = std::min(block_size, total_frames - frame);
+
+        LV2_Atom_Forge_Frame seq_frame;
+        lv2_atom_forge_set_buffer(&forge, sequence, sizeof(sequence));
+        lv2_atom_forge_sequence_head(&forge, &seq_frame, 0);
+        if (frame == 0 && bankfile) {
+            LV2_Atom_Forge_Frame obj_frame;
+            lv2_atom_forge_frame_time(&forge, 0);
+            lv2_atom_forge_object(&forge, &obj_frame, 0, patch_Set);
+            lv2_atom_forge_key(&forge, patch_property);
+            lv2_atom_forge_urid(&forge, bank);
+            lv2_atom_forge_key(&forge, patch_value);
+            lv2_atom_forge_path(&forge, bankfile, strlen(bankfile));
+            lv2_atom_forge_pop(&forge, &obj_frame);
+        }
+        for (; note_index < notes.size() && notes[note_index].frame < frame + nframes; ++note_index) {
+            const Note &note = notes[note_index];
+            lv2_atom_forge_frame_time(&forge, note.frame - frame);
+            lv2_atom_forge_atom(&forge, 3, midi_MidiEvent);
+            lv2_atom_forge_write(&forge, note.msg, 3);
+        }
+        lv2_atom_forge_pop(&forge, &seq_frame);
+
+        desc->run(host.instance, nframes);
+        host_run_worker(host);
+
+        for (unsigned i = 0; i < nframes; ++i) {
+            double level = std::max(fabs(left[i]), fabs(right[i]));
+            if (level > 1e-4 && onset == (unsigned)-1)
+                onset = frame + i;
+            peak = std::max(peak, level);
+            samples.push_back(left[i]);
+            samples.push_back(right[i]);
+        }
+    }
+
+    fprintf(stderr, "Rendered %u frames, peak %.1f dB\n", total_frames, 20 * log10(peak));
+    if (onset == (unsigned)-1) {
+        fprintf(stderr, "The output is silent.\n");
+        return 1;
+    }
+    fprintf(stderr, "First note at frame %u, heard at frame %u\n", first_frame, onset);
+    if (onset < first_frame) {
+        fprintf(stderr, "The output starts before the first note.\n");
+        return 1;
+    }
+
+    if (state) {
+        if (state->save(host.instance, &host_store, &host, 0, features) != LV2_STATE_SUCCESS) {
+            fprintf(stderr, "Cannot save the state.\n");
+            return 1;
+        }
+        size_t size = 0;
+        for (const auto &property : host.state)
+            size += property.second.second.size();
+
+        LV2_Handle other = desc->instantiate(desc, sample_rate, "", features);
+        if (!other || state->restore(other, &host_retrieve, &host, 0, features) != LV2_STATE_SUCCESS) {
+            fprintf(stderr, "Cannot restore the state.\n");
+            return 1;
+        }
+        desc->cleanup(other);
+        fprintf(stderr, "Saved and restored a state of %zu bytes\n", size);
+    }
+
+    if (desc->deactivate)
+        desc->deactivate(host.instance);
+    desc->cleanup(host.instance);
+
+    if (output && !write_wav(output, samples)) {
+        fprintf(stderr, "Cannot write the output.\n");
+        return 1;
+    }
+
+    return 0;
+}
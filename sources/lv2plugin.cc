@@ -0,0 +1,496 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "lv2plugin.h"
+#include "common.h"
+#include "bank.h"
+#include "bank_cache.h"
+#include "synth_instance.h"
+#include "state_generated.h"
+#include <lv2/core/lv2.h>
+#include <lv2/atom/atom.h>
+#include <lv2/atom/util.h>
+#include <lv2/midi/midi.h>
+#include <lv2/patch/patch.h>
+#include <lv2/urid/urid.h>
+#include <lv2/worker/worker.h>
+#include <lv2/state/state.h>
+#include <mutex>
+#include <string>
+#include <algorithm>
+#include <string.h>
+
+// Every instance has its own synthesizer, unlike the programs which have a
+// single one in globals, so that a host can run many of them at once.
+
+// the banks are shared by all the instances of the process
+static Bank_Cache &lv2_bank_cache()
+{
+    static Bank_Cache cache(default_bank_cache_budget);
+    return cache;
+}
+
+struct Lv2_Uris {
+    LV2_URID atom_Chunk;
+    LV2_URID atom_Int;
+    LV2_URID atom_Object;
+    LV2_URID atom_Path;
+    LV2_URID atom_URID;
+    LV2_URID midi_MidiEvent;
+    LV2_URID patch_Set;
+    LV2_URID patch_property;
+    LV2_URID patch_value;
+    LV2_URID bank;
+    LV2_URID emulator;
+    LV2_URID chip_count;
+    LV2_URID state;
+};
+
+enum Lv2_Work_Type {
+    Lv2_Work_Load_Bank,
+    Lv2_Work_Set_Emulator,
+    Lv2_Work_Set_Chip_Count,
+    Lv2_Work_Free_Player,
+};
+
+// a message to the worker and back, followed by the path of the bank
+struct Lv2_Work {
+    Lv2_Work_Type type;
+    unsigned value = 0;
+    Player *player = nullptr;
+};
+
+struct Lv2_Instance {
+    LV2_URID_Map *map = nullptr;
+    LV2_Worker_Schedule *schedule = nullptr;
+    Lv2_Uris uris;
+
+    const LV2_Atom_Sequence *control_port = nullptr;
+    float *left_port = nullptr;
+    float *right_port = nullptr;
+    const float *volume_port = nullptr;
+
+    std::unique_ptr<Synth_Instance> synth;
+};
+
+// handle a patch message, by asking the worker to prepare another player
+static void lv2_handle_patch(Lv2_Instance &self, const LV2_Atom_Object *obj)
+{
+    const Lv2_Uris &uris = self.uris;
+    if (obj->body.otype != uris.patch_Set || !self.schedule)
+        return;
+
+    const LV2_Atom *property = nullptr;
+    const LV2_Atom *value = nullptr;
+    lv2_atom_object_get(obj, uris.patch_property, &property, uris.patch_value, &value, 0);
+    if (!property || property->type != uris.atom_URID || !value)
+        return;
+
+    LV2_URID key = ((const LV2_Atom_URID *)property)->body;
+    Lv2_Work work;
+
+    if (key == uris.bank && value->type == uris.atom_Path) {
+        const char *path = (const char *)LV2_ATOM_BODY_CONST(value);
+        size_t size = strnlen(path, value->size);
+        uint8_t message[sizeof(Lv2_Work) + 1024];
+        if (size >= sizeof(message) - sizeof(Lv2_Work))
+            return;
+        work.type = Lv2_Work_Load_Bank;
+        memcpy(message, &work, sizeof(Lv2_Work));
+        memcpy(message + sizeof(Lv2_Work), path, size);
+        message[sizeof(Lv2_Work) + size] = '\0';
+        self.schedule->schedule_work(self.schedule->handle, sizeof(Lv2_Work) + size + 1, message);
+        return;
+    }
+
+    if (value->type != uris.atom_Int)
+        return;
+    int number = ((const LV2_Atom_Int *)value)->body;
+    if (number < 0)
+        return;
+    work.value = number;
+    if (key == uris.emulator)
+        work.type = Lv2_Work_Set_Emulator;
+    else if (key == uris.chip_count && number > 0)
+        work.type = Lv2_Work_Set_Chip_Count;
+    else
+        return;
+    self.schedule->schedule_work(self.schedule->handle, sizeof(Lv2_Work), &work);
+}
+
+// the descriptor of a plugin is at the index of its player type
+static LV2_Descriptor lv2_descriptors[player_type_count];
+
+///
+static LV2_Handle lv2_instantiate(const LV2_Descriptor *desc, double sample_rate, const char *bundle_path, const LV2_Feature *const *features)
+{
+    std::unique_ptr<Lv2_Instance> self(new Lv2_Instance);
+    Player_Type pt = Player_Type(desc - lv2_descriptors);
+
+    for (const LV2_Feature *const *f = features; *f; ++f) {
+        if (!strcmp((*f)->URI, LV2_URID__map))
+            self->map = (LV2_URID_Map *)(*f)->data;
+        else if (!strcmp((*f)->URI, LV2_WORKER__schedule))
+            self->schedule = (LV2_Worker_Schedule *)(*f)->data;
+    }
+    if (!self->map)
+        return nullptr;
+
+    LV2_URID_Map *map = self->map;
+    Lv2_Uris &uris = self->uris;
+    uris.atom_Chunk = map->map(map->handle, LV2_ATOM__Chunk);
+    uris.atom_Int = map->map(map->handle, LV2_ATOM__Int);
+    uris.atom_Object = map->map(map->handle, LV2_ATOM__Object);
+    uris.atom_Path = map->map(map->handle, LV2_ATOM__Path);
+    uris.atom_URID = map->map(map->handle, LV2_ATOM__URID);
+    uris.midi_MidiEvent = map->map(map->handle, LV2_MIDI__MidiEvent);
+    uris.patch_Set = map->map(map->handle, LV2_PATCH__Set);
+    uris.patch_property = map->map(map->handle, LV2_PATCH__property);
+    uris.patch_value = map->map(map->handle, LV2_PATCH__value);
+    uris.bank = map->map(map->handle, ADLJACK_LV2__bank);
+    uris.emulator = map->map(map->handle, ADLJACK_LV2__emulator);
+    uris.chip_count = map->map(map->handle, ADLJACK_LV2__chipCount);
+    uris.state = map->map(map->handle, ADLJACK_LV2__state);
+
+    Synth_Instance *synth = new Synth_Instance(pt, (unsigned)sample_rate, lv2_bank_cache());
+    self->synth.reset(synth);
+    Synth_Instance::Setup setup;
+    std::unique_ptr<Player> player = synth->prepare_player(setup);
+    if (!player)
+        return nullptr;
+    synth->exchange_player(std::move(player));
+    synth->commit_setup(setup);
+
+    return self.release();
+}
+
+static void lv2_connect_port(LV2_Handle instance, uint32_t port, void *data)
+{
+    Lv2_Instance &self = *(Lv2_Instance *)instance;
+    switch (port) {
+    case Lv2_Port_Control:
+        self.control_port = (const LV2_Atom_Sequence *)data; break;
+    case Lv2_Port_Left:
+        self.left_port = (float *)data; break;
+    case Lv2_Port_Right:
+        self.right_port = (float *)data; break;
+    case Lv2_Port_Volume:
+        self.volume_port = (const float *)data; break;
+    }
+}
+
+static void lv2_activate(LV2_Handle instance)
+{
+    Lv2_Instance &self = *(Lv2_Instance *)instance;
+    self.synth->panic();
+}
+
+// the events play at their frame in the block: the block is rendered in
+// parts, which end where the events are due
+static void lv2_run(LV2_Handle instance, uint32_t nframes)
+{
+    Lv2_Instance &self = *(Lv2_Instance *)instance;
+    const Lv2_Uris &uris = self.uris;
+    Synth_Instance &synth = *self.synth;
+    float *left = self.left_port;
+    float *right = self.right_port;
+    unsigned position = 0;
+
+    if (self.volume_port)
+        synth.set_volume((int)*self.volume_port);
+
+    if (self.control_port) {
+        LV2_ATOM_SEQUENCE_FOREACH(self.control_port, ev) {
+            unsigned time = std::min((unsigned)ev->time.frames, (unsigned)nframes);
+            if (time > position) {
+                synth.render(left + position, right + position, time - position);
+                position = time;
+            }
+            if (ev->body.type == uris.midi_MidiEvent) {
+                const uint8_t *msg = (const uint8_t *)LV2_ATOM_BODY_CONST(&ev->body);
+                Player::Event event;
+                if (Player::decode_event(msg, ev->body.size, event))
+                    synth.play_event(event);
+            }
+            else if (ev->body.type == uris.atom_Object)
+                lv2_handle_patch(self, (const LV2_Atom_Object *)&ev->body);
+        }
+    }
+
+    synth.render(left + position, right + position, nframes - position);
+}
+
+static void lv2_cleanup(LV2_Handle instance)
+{
+    delete (Lv2_Instance *)instance;
+}
+
+///
+static LV2_Worker_Status lv2_work(LV2_Handle instance, LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle handle, uint32_t size, const void *data)
+{
+    Lv2_Instance &self = *(Lv2_Instance *)instance;
+    if (size < sizeof(Lv2_Work))
+        return LV2_WORKER_ERR_UNKNOWN;
+
+    Lv2_Work work;
+    memcpy(&work, data, sizeof(Lv2_Work));
+
+    if (work.type == Lv2_Work_Free_Player) {
+        delete work.player;
+        return LV2_WORKER_SUCCESS;
+    }
+
+    // the worker runs one job at a time, so the setup is not changed
+    // by another between reading and committing it
+    Synth_Instance &synth = *self.synth;
+    Synth_Instance::Setup setup = synth.setup();
+
+    switch (work.type) {
+    case Lv2_Work_Load_Bank:
+        setup.bank_file.assign((const char *)data + sizeof(Lv2_Work), size - sizeof(Lv2_Work) - 1);
+        break;
+    case Lv2_Work_Set_Emulator:
+        setup.emulator = work.value;
+        break;
+    case Lv2_Work_Set_Chip_Count:
+        setup.chip_count = work.value;
+        break;
+    default:
+        return LV2_WORKER_ERR_UNKNOWN;
+    }
+
+    work.player = synth.prepare_player(setup).release();
+    if (!work.player)
+        return LV2_WORKER_ERR_UNKNOWN;
+
+    if (respond(handle, sizeof(Lv2_Work), &work) != LV2_WORKER_SUCCESS) {
+        delete work.player;
+        return LV2_WORKER_ERR_NO_SPACE;
+    }
+    // the audio side takes the player at the response
+    synth.commit_setup(setup);
+    return LV2_WORKER_SUCCESS;
+}
+
+// on the audio side, take over the prepared player, and send back the old
+// one to be deleted by the worker
+static LV2_Worker_Status lv2_work_response(LV2_Handle instance, uint32_t size, const void *data)
+{
+    Lv2_Instance &self = *(Lv2_Instance *)instance;
+    if (size != sizeof(Lv2_Work))
+        return LV2_WORKER_ERR_UNKNOWN;
+
+    Lv2_Work work;
+    memcpy(&work, data, sizeof(Lv2_Work));
+
+    Lv2_Work release;
+    release.type = Lv2_Work_Free_Player;
+    release.player = self.synth->exchange_player(std::unique_ptr<Player>(work.player)).release();
+
+    if (self.schedule->schedule_work(self.schedule->handle, sizeof(Lv2_Work), &release) != LV2_WORKER_SUCCESS)
+        delete release.player;  // should not happen, but do not leak it
+    return LV2_WORKER_SUCCESS;
+}
+
+///
+static LV2_State_Status lv2_save(LV2_Handle instance, LV2_State_Store_Function store, LV2_State_Handle handle, uint32_t flags, const LV2_Feature *const *features)
+{
+    Lv2_Instance &self = *(Lv2_Instance *)instance;
+    const Lv2_Uris &uris = self.uris;
+
+    LV2_State_Map_Path *map_path = nullptr;
+    LV2_State_Free_Path *free_path = nullptr;
+    for (const LV2_Feature *const *f = features; *f; ++f) {
+        if (!strcmp((*f)->URI, LV2_STATE__mapPath))
+            map_path = (LV2_State_Map_Path *)(*f)->data;
+        else if (!strcmp((*f)->URI, LV2_STATE__freePath))
+            free_path = (LV2_State_Free_Path *)(*f)->data;
+    }
+
+    const Synth_Instance &synth = *self.synth;
+    Synth_Instance::Setup setup = synth.setup();
+    Player_Type pt = synth.player_type();
+
+    // the path of the bank is stored relative to the session if possible
+    std::string bank_file = setup.bank_file;
+    if (map_path && !bank_file.empty()) {
+        char *abstract = map_path->abstract_path(map_path->handle, bank_file.c_str());
+        if (abstract) {
+            bank_file.assign(abstract);
+            if (free_path)
+                free_path->free_path(free_path->handle, abstract);
+            else
+                free(abstract);
+        }
+    }
+
+    using namespace fb::state;
+    flatbuffers::FlatBufferBuilder builder(1024);
+
+    std::vector<flatbuffers::Offset<Channel_State>> channel_vector;
+    channel_vector.reserve(16);
+    for (unsigned i = 0; i < 16; ++i) {
+        Program program = synth.program(i);
+        auto channel = CreateChannel_State(
+            builder, program.gm, (program.bank_msb << 7) | program.bank_lsb);
+        channel_vector.push_back(channel);
+    }
+
+    const char *player_name = Player::name(pt);
+    const char *emulator_name = "";
+    for (const Player::Emulator &emu : Player::enumerate_emulators(pt)) {
+        if (emu.id == setup.emulator)
+            emulator_name = emu.name;
+    }
+
+    // the plugin has a single player
+    std::vector<flatbuffers::Offset<Player_State>> player_vector;
+    player_vector.push_back(CreatePlayer_State(
+        builder,
+        CreatePlayer_Id(
+            builder,
+            builder.CreateString(player_name),
+            builder.CreateString(emulator_name)),
+        builder.CreateString(bank_file)));
+
+    // the volume is a port, which the host saves by itself
+    unsigned volume = synth.volume();
+
+    auto state = CreateState(
+        builder,
+        builder.CreateVector(channel_vector),
+        builder.CreateVector(player_vector),
+        setup.chip_count,
+        volume,
+        CreatePlayer_Id(
+            builder,
+            builder.CreateString(player_name),
+            builder.CreateString(emulator_name)));
+    builder.Finish(state);
+
+    return store(handle, uris.state, builder.GetBufferPointer(), builder.GetSize(),
+                 uris.atom_Chunk, LV2_STATE_IS_POD|LV2_STATE_IS_PORTABLE);
+}
+
+// it does not run concurrently with the audio, so the player is replaced
+// directly
+static LV2_State_Status lv2_restore(LV2_Handle instance, LV2_State_Retrieve_Function retrieve, LV2_State_Handle handle, uint32_t flags, const LV2_Feature *const *features)
+{
+    Lv2_Instance &self = *(Lv2_Instance *)instance;
+    const Lv2_Uris &uris = self.uris;
+    Synth_Instance &synth = *self.synth;
+
+    LV2_State_Map_Path *map_path = nullptr;
+    LV2_State_Free_Path *free_path = nullptr;
+    for (const LV2_Feature *const *f = features; *f; ++f) {
+        if (!strcmp((*f)->URI, LV2_STATE__mapPath))
+            map_path = (LV2_State_Map_Path *)(*f)->data;
+        else if (!strcmp((*f)->URI, LV2_STATE__freePath))
+            free_path = (LV2_State_Free_Path *)(*f)->data;
+    }
+
+    size_t size = 0;
+    uint32_t type = 0;
+    uint32_t valflags = 0;
+    const uint8_t *data = (const uint8_t *)retrieve(handle, uris.state, &size, &type, &valflags);
+    if (!data || type != uris.atom_Chunk)
+        return LV2_STATE_ERR_NO_PROPERTY;
+
+    using namespace fb::state;
+
+    flatbuffers::Verifier verifier(data, size);
+    if (!VerifyStateBuffer(verifier))
+        return LV2_STATE_ERR_UNKNOWN;
+
+    auto state = GetState(data);
+    if (state->channel()->size() != 16)
+        return LV2_STATE_ERR_UNKNOWN;
+
+    Synth_Instance::Setup setup;
+    setup.chip_count = std::max(1u, (unsigned)state->chip_count());
+
+    // the state of another type of player gives only the channels
+    Player_Type pt = Player::type_by_name(state->active_id()->player()->c_str());
+    if (pt == synth.player_type()) {
+        unsigned emu = Player::emulator_by_name(pt, state->active_id()->emulator()->c_str());
+        if (emu != (unsigned)-1)
+            setup.emulator = emu;
+        for (const auto *player : *state->player()) {
+            const auto *bank_file = player->bank_file();
+            if (Player::type_by_name(player->id()->player()->c_str()) != pt || !bank_file)
+                continue;
+            setup.bank_file = bank_file->str();
+        }
+    }
+
+    if (map_path && !setup.bank_file.empty()) {
+        char *absolute = map_path->absolute_path(map_path->handle, setup.bank_file.c_str());
+        if (absolute) {
+            setup.bank_file.assign(absolute);
+            if (free_path)
+                free_path->free_path(free_path->handle, absolute);
+            else
+                free(absolute);
+        }
+    }
+
+    for (unsigned i = 0; i < 16; ++i) {
+        const auto *channel = state->channel()->Get(i);
+        Program program;
+        program.gm = channel->program() & 0x7f;
+        program.bank_lsb = channel->bank() & 0x7f;
+        program.bank_msb = (channel->bank() >> 7) & 0x7f;
+        synth.set_program(i, program);
+    }
+
+    std::unique_ptr<Player> player = synth.prepare_player(setup);
+    if (!player)
+        return LV2_STATE_ERR_UNKNOWN;
+    synth.exchange_player(std::move(player));
+    synth.commit_setup(setup);
+    return LV2_STATE_SUCCESS;
+}
+
+///
+static const void *lv2_extension_data(const char *uri)
+{
+    if (!strcmp(uri, LV2_WORKER__interface)) {
+        static const LV2_Worker_Interface worker = {
+            &lv2_work, &lv2_work_response, nullptr };
+        return &worker;
+    }
+    if (!strcmp(uri, LV2_STATE__interface)) {
+        static const LV2_State_Interface state = {
+            &lv2_save, &lv2_restore };
+        return &state;
+    }
+    return nullptr;
+}
+
+static void lv2_make_descriptors()
+{
+    static std::string uris[player_type_count];
+
+    for (unsigned i = 0; i < player_type_count; ++i) {
+        uris[i] = ADLJACK_LV2_PREFIX + std::string(Player::name((Player_Type)i));
+        LV2_Descriptor &desc = lv2_descriptors[i];
+        desc.URI = uris[i].c_str();
+        desc.instantiate = &lv2_instantiate;
+        desc.connect_port = &lv2_connect_port;
+        desc.activate = &lv2_activate;
+        desc.run = &lv2_run;
+        desc.deactivate = nullptr;
+        desc.cleanup = &lv2_cleanup;
+        desc.extension_data = &lv2_extension_data;
+    }
+}
+
+LV2_SYMBOL_EXPORT
+const LV2_Descriptor *lv2_descriptor(uint32_t index)
+{
+    static std::once_flag once;
+    std::call_once(once, &lv2_make_descriptors);
+    return (index < player_type_count) ? &lv2_descriptors[index] : nullptr;
+}
@@ -0,0 +1,25 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+// the plugins, one for each type of player
+#define ADLJACK_LV2_URI "https://github.com/jpcima/adljack"
+#define ADLJACK_LV2_PREFIX ADLJACK_LV2_URI "#"
+
+// the properties which are set with patch messages
+#define ADLJACK_LV2__bank ADLJACK_LV2_PREFIX "bank"
+#define ADLJACK_LV2__emulator ADLJACK_LV2_PREFIX "emulator"
+#define ADLJACK_LV2__chipCount ADLJACK_LV2_PREFIX "chipCount"
+// the state, in the format of `state.fbs`
+#define ADLJACK_LV2__state ADLJACK_LV2_PREFIX "state"
+
+enum Lv2_Port {
+    Lv2_Port_Control,
+    Lv2_Port_Left,
+    Lv2_Port_Right,
+    Lv2_Port_Volume,
+    Lv2_Port_Count,
+};
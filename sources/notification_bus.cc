@@ -0,0 +1,101 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "notification_bus.h"
+#include "seqlock.h"
+#include <algorithm>
+#include <atomic>
+#include <stddef.h>
+#include <string.h>
+
+// an event, with its position in the sequence of all the events
+struct Notification_Record {
+    unsigned long index;
+    Notification_Event event;
+};
+
+struct Notification_Bus::Impl {
+    unsigned capacity = 0;
+    std::unique_ptr<Seqlock<Notification_Record>[]> ring;
+    std::atomic<unsigned long> head{0};
+    Seqlock<Notification_Value> slot[notification_slot_count];
+};
+
+Notification_Bus::Notification_Bus(unsigned event_capacity)
+    : P(new Impl)
+{
+    P->capacity = event_capacity;
+    P->ring.reset(new Seqlock<Notification_Record>[event_capacity]);
+}
+
+Notification_Bus::~Notification_Bus()
+{
+}
+
+auto Notification_Bus::subscribe() const -> Cursor
+{
+    Cursor cursor;
+    cursor.event = P->head.load(std::memory_order_acquire);
+    return cursor;
+}
+
+void Notification_Bus::post(Notification_Type type, const uint8_t *data, unsigned size)
+{
+    unsigned long index = P->head.load(std::memory_order_relaxed);
+
+    Notification_Record rec;
+    rec.index = index;
+    rec.event.type = type;
+    rec.event.size = std::min(size, notification_event_size_max);
+    memcpy(rec.event.data, data, rec.event.size);
+
+    // copy the event only as far as its data goes
+    size_t used = offsetof(Notification_Record, event) +
+        offsetof(Notification_Event, data) + rec.event.size;
+    P->ring[index % P->capacity].store(rec, used);
+    P->head.store(index + 1, std::memory_order_release);
+}
+
+void Notification_Bus::set(Notification_Slot slot, const Notification_Value &value)
+{
+    size_t used = offsetof(Notification_Value, data) + value.size;
+    P->slot[slot].store(value, used);
+}
+
+bool Notification_Bus::next(Cursor &cursor, Notification_Event &event, unsigned long *lost) const
+{
+    const unsigned capacity = P->capacity;
+    unsigned long skipped = 0;
+    Notification_Record rec;
+
+    for (;;) {
+        unsigned long head = P->head.load(std::memory_order_acquire);
+        if (cursor.event >= head)
+            return false;
+        if (head - cursor.event > capacity) {
+            skipped += head - capacity - cursor.event;
+            cursor.event = head - capacity;
+        }
+        P->ring[cursor.event % capacity].load(rec);
+        // otherwise, it was overwritten while reading
+        if (rec.index == cursor.event)
+            break;
+    }
+
+    ++cursor.event;
+    event = rec.event;
+    if (lost)
+        *lost = skipped;
+    return true;
+}
+
+bool Notification_Bus::get(Cursor &cursor, Notification_Slot slot, Notification_Value &value) const
+{
+    const Seqlock<Notification_Value> &lock = P->slot[slot];
+    if (lock.sequence() == cursor.slot[slot])
+        return false;
+    cursor.slot[slot] = lock.load(value);
+    return true;
+}
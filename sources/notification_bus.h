@@ -0,0 +1,69 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "player.h"
+#include <memory>
+#include <stdint.h>
+
+// the notifications which are events, each one delivered
+enum Notification_Type {
+    Notify_TextInsert,
+};
+
+// the notifications which are states, the last one replacing the others
+enum Notification_Slot {
+    Notify_Channels,
+    notification_slot_count,
+};
+
+static constexpr unsigned notification_event_size_max = 256;
+// the description of the voices: the letters, then the attributes
+static constexpr unsigned notification_slot_size_max = 2 * (player_max_chips * player_max_channels + 1);
+
+struct Notification_Event {
+    Notification_Type type;
+    unsigned size;
+    uint8_t data[notification_event_size_max];
+};
+
+struct Notification_Value {
+    unsigned size = 0;
+    uint8_t data[notification_slot_size_max];
+};
+
+// Notifications from the audio side to any number of consumers, each one
+// reading at its own position. The events are kept in a ring, where the
+// newest overwrite the oldest if a consumer falls behind, and the states in
+// slots, where a value replaces the previous one. The audio side does not
+// wait, nor does it depend on the consumers.
+class Notification_Bus {
+public:
+    explicit Notification_Bus(unsigned event_capacity);
+    ~Notification_Bus();
+
+    // the position of a consumer
+    struct Cursor {
+        unsigned long event = 0;
+        unsigned long slot[notification_slot_count] = {};
+    };
+    // the position of a new consumer, which receives the next events, and
+    // the current states
+    Cursor subscribe() const;
+
+    // on the audio side, from one thread
+    void post(Notification_Type type, const uint8_t *data, unsigned size);
+    void set(Notification_Slot slot, const Notification_Value &value);
+
+    // get the next event of the consumer. the events which were overwritten
+    // are skipped, and counted into `lost` if not null.
+    bool next(Cursor &cursor, Notification_Event &event, unsigned long *lost = nullptr) const;
+    // get the value of the slot, if it changed since the consumer got it
+    bool get(Cursor &cursor, Notification_Slot slot, Notification_Value &value) const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> P;
+};
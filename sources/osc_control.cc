@@ -0,0 +1,474 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "osc_control.h"
+#include "common.h"
+#include "bank_cache.h"
+#include <lo/lo.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+namespace stc = std::chrono;
+
+static constexpr size_t osc_packet_max = 4096;
+static constexpr unsigned osc_subscribers_max = 8;
+static constexpr unsigned osc_stream_rate_max = 100;
+static const char osc_prefix[] = "/adljack/";
+
+struct Osc_Address {
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+};
+
+static bool operator==(const Osc_Address &a, const Osc_Address &b)
+{
+    return a.len == b.len && memcmp(&a.addr, &b.addr, a.len) == 0;
+}
+
+enum Osc_Command_Type {
+    Osc_Bank,
+    Osc_Emulator,
+    Osc_Chips,
+    Osc_Volume,
+    Osc_Panic,
+};
+
+// a command for the interface side
+struct Osc_Command {
+    Osc_Command_Type type;
+    std::string path;
+    int value = 0;
+    std::string text;
+    Osc_Address source;
+};
+
+struct Osc_Subscriber {
+    Osc_Address address;
+    stc::steady_clock::duration interval;
+    stc::steady_clock::time_point next;
+};
+
+struct Osc_Control::Impl {
+    int fd = -1;
+    int stop_pipe[2] = {-1, -1};
+    std::thread thread;
+
+    std::mutex commands_mutex;
+    std::deque<Osc_Command> commands;
+
+    // only on the server thread
+    std::vector<Osc_Subscriber> subscribers;
+    Notification_Bus::Cursor notification_cursor;
+    Notification_Value channels;
+
+    void run();
+    void receive();
+    void dispatch(uint8_t *data, size_t size, const Osc_Address &source);
+    void dispatch_message(const char *path, lo_message msg, const Osc_Address &source);
+    void subscribe(const Osc_Address &source, double rate);
+    void unsubscribe(const Osc_Address &source);
+    void stream(stc::steady_clock::time_point now);
+    void send(const Osc_Address &to, const char *path, lo_message msg);
+    void reply_error(const Osc_Address &to, const char *path, const char *reason);
+    const char *apply(const Osc_Command &cmd);
+};
+
+Osc_Control::Osc_Control()
+    : P(new Impl)
+{
+}
+
+Osc_Control::~Osc_Control()
+{
+    stop();
+}
+
+bool Osc_Control::start(const char *address, const char *port)
+{
+    stop();
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    addrinfo *res = nullptr;
+    if (getaddrinfo(address ? address : "127.0.0.1", port, &hints, &res) != 0)
+        return false;
+
+    int fd = -1;
+    for (addrinfo *ai = res; ai && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd != -1 && bind(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+
+    if (fd == -1 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1 ||
+        pipe(P->stop_pipe) == -1) {
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+
+    P->fd = fd;
+    P->thread = std::thread([this]() { P->run(); });
+    return true;
+}
+
+void Osc_Control::stop()
+{
+    if (P->fd == -1)
+        return;
+
+    char byte = 0;
+    ssize_t count = write(P->stop_pipe[1], &byte, 1);
+    (void)count;
+    P->thread.join();
+
+    for (int &fd : P->stop_pipe) {
+        close(fd);
+        fd = -1;
+    }
+    close(P->fd);
+    P->fd = -1;
+    if (!P->subscribers.empty())
+        set_channel_description(false);
+    P->subscribers.clear();
+    P->commands.clear();
+}
+
+void Osc_Control::process()
+{
+    std::deque<Osc_Command> commands;
+    {
+        std::lock_guard<std::mutex> lock(P->commands_mutex);
+        commands.swap(P->commands);
+    }
+
+    for (const Osc_Command &cmd : commands) {
+        if (const char *error = P->apply(cmd))
+            P->reply_error(cmd.source, cmd.path.c_str(), error);
+    }
+}
+
+// the commands apply the same way as the keys of the terminal interface
+const char *Osc_Control::Impl::apply(const Osc_Command &cmd)
+{
+    if (!have_active_player())
+        return "no player";
+    Player &player = active_player();
+
+    switch (cmd.type) {
+    case Osc_Bank: {
+        std::shared_ptr<const Bank> bank = ::bank_cache->load(player.type(), cmd.text.c_str());
+        if (!bank || !dynamic_update_bank(player, bank))
+            return "cannot load the bank";
+        active_bank_file() = cmd.text;
+        break;
+    }
+    case Osc_Emulator:
+        if (cmd.value < 0 || (unsigned)cmd.value >= ::emulator_ids.size())
+            return "invalid emulator";
+        if ((unsigned)cmd.value != ::active_emulator_id && !dynamic_switch_emulator_id(cmd.value))
+            return "busy";
+        break;
+    case Osc_Chips:
+        if (cmd.value < 1 || (unsigned)cmd.value > player_max_chips)
+            return "invalid chip count";
+        if ((unsigned)cmd.value != active_chip_count() && !dynamic_switch_chip_count(cmd.value))
+            return "busy";
+        break;
+    case Osc_Volume:
+        ::player_volume = std::max(volume_min, std::min(volume_max, cmd.value));
+        break;
+    case Osc_Panic:
+        player.dynamic_panic();
+        break;
+    }
+    return nullptr;
+}
+
+void Osc_Control::Impl::run()
+{
+    for (;;) {
+        // sleep until the next frame of the stream, if any
+        int wait_ms = -1;
+        if (!subscribers.empty()) {
+            stc::steady_clock::time_point next = subscribers[0].next;
+            for (const Osc_Subscriber &sub : subscribers)
+                next = std::min(next, sub.next);
+            stc::steady_clock::duration left = next - stc::steady_clock::now();
+            wait_ms = (int)std::max<long>(0, stc::duration_cast<stc::milliseconds>(left).count());
+        }
+
+        pollfd fds[2] = {{fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+        if (poll(fds, 2, wait_ms) == -1 && errno != EINTR)
+            break;
+        if (fds[1].revents & POLLIN)
+            break;
+        if (fds[0].revents & POLLIN)
+            receive();
+
+        stream(stc::steady_clock::now());
+    }
+}
+
+void Osc_Control::Impl::receive()
+{
+    uint8_t packet[osc_packet_max];
+    for (;;) {
+        Osc_Address source;
+        ssize_t size = recvfrom(fd, packet, sizeof(packet), 0, (sockaddr *)&source.addr, &source.len);
+        if (size == -1 && errno == EINTR)
+            continue;
+        if (size <= 0)
+            break;
+        dispatch(packet, size, source);
+    }
+}
+
+void Osc_Control::Impl::dispatch(uint8_t *data, size_t size, const Osc_Address &source)
+{
+    // the elements of a bundle apply at once, whatever their time tag
+    static const char bundle_tag[8] = "#bundle";
+    if (size >= 16 && memcmp(data, bundle_tag, 8) == 0) {
+        for (size_t pos = 16; pos + 4 <= size;) {
+            size_t len = ((size_t)data[pos] << 24) | (data[pos + 1] << 16) |
+                (data[pos + 2] << 8) | data[pos + 3];
+            pos += 4;
+            if (len > size - pos)
+                break;
+            dispatch(data + pos, len, source);
+            pos += len;
+        }
+        return;
+    }
+
+    int result = 0;
+    lo_message msg = lo_message_deserialise(data, size, &result);
+    if (!msg)
+        return;
+    dispatch_message(lo_get_path(data, size), msg, source);
+    lo_message_free(msg);
+}
+
+// a finite number of any of the numeric types
+static bool osc_number(const char *types, lo_arg **argv, unsigned index, double &value)
+{
+    switch (types[index]) {
+    case 'i': value = argv[index]->i; break;
+    case 'h': value = argv[index]->h; break;
+    case 'f': value = argv[index]->f; break;
+    case 'd': value = argv[index]->d; break;
+    default: return false;
+    }
+    return std::isfinite(value);
+}
+
+// the integer part of a finite number, clamped to the range of int, which
+// the commands reject or clamp further
+static int osc_int(double value)
+{
+    return (int)std::max<double>(INT_MIN + 1, std::min<double>(INT_MAX, value));
+}
+
+void Osc_Control::Impl::dispatch_message(const char *path, lo_message msg, const Osc_Address &source)
+{
+    size_t prefix_len = sizeof(osc_prefix) - 1;
+    if (strncmp(path, osc_prefix, prefix_len) != 0)
+        return;
+    std::string method(path + prefix_len);
+
+    const char *types = lo_message_get_types(msg);
+    lo_arg **argv = lo_message_get_argv(msg);
+    unsigned argc = lo_message_get_argc(msg);
+
+    double number[4];
+    unsigned numbers = 0;
+    while (numbers < std::min(argc, 4u) && osc_number(types, argv, numbers, number[numbers]))
+        ++numbers;
+    bool numeric = numbers == argc;
+
+    Osc_Command cmd;
+    cmd.source = source;
+
+    if (method == "bank" && argc == 1 && types[0] == 's') {
+        cmd.type = Osc_Bank;
+        cmd.text = &argv[0]->s;
+    }
+    else if (method == "emulator" && numeric && argc == 1) {
+        cmd.type = Osc_Emulator;
+        cmd.value = osc_int(number[0]);
+    }
+    else if (method == "chips" && numeric && argc == 1) {
+        cmd.type = Osc_Chips;
+        cmd.value = osc_int(number[0]);
+    }
+    else if (method == "volume" && numeric && argc == 1) {
+        cmd.type = Osc_Volume;
+        cmd.value = osc_int(std::round(number[0]));
+    }
+    else if (method == "panic" && argc == 0)
+        cmd.type = Osc_Panic;
+    else if (method == "program" && numeric && (argc == 2 || argc == 4)) {
+        // channel from 1, program, and optionally the bank MSB and LSB
+        int channel = osc_int(number[0]) - 1;
+        bool valid = channel >= 0 && channel < 16;
+        for (unsigned i = 1; i < argc; ++i)
+            valid = valid && number[i] >= 0 && number[i] < 128;
+        if (!valid)
+            return reply_error(source, path, "invalid arguments");
+        bool queued = true;
+        if (argc == 4) {
+            const uint8_t msb[3] = {(uint8_t)(0xb0 | channel), 0, (uint8_t)number[2]};
+            const uint8_t lsb[3] = {(uint8_t)(0xb0 | channel), 32, (uint8_t)number[3]};
+            queued = queue_midi(msb, 3) && queue_midi(lsb, 3);
+        }
+        const uint8_t pgm[2] = {(uint8_t)(0xc0 | channel), (uint8_t)number[1]};
+        if (!queued || !queue_midi(pgm, 2))
+            reply_error(source, path, "busy");
+        return;
+    }
+    else if (method == "subscribe" && numeric && argc <= 1)
+        return subscribe(source, (argc == 1) ? number[0] : ::arg_ui_fps);
+    else if (method == "unsubscribe" && argc == 0)
+        return unsubscribe(source);
+    else
+        return reply_error(source, path, "unknown method or invalid arguments");
+
+    cmd.path = path;
+    {
+        std::lock_guard<std::mutex> lock(commands_mutex);
+        commands.push_back(std::move(cmd));
+    }
+    wakeup_interface();
+}
+
+void Osc_Control::Impl::subscribe(const Osc_Address &source, double rate)
+{
+    if (!(rate >= 1 && rate <= osc_stream_rate_max))
+        return reply_error(source, "/adljack/subscribe", "invalid rate");
+
+    auto it = std::find_if(subscribers.begin(), subscribers.end(),
+                           [&source](const Osc_Subscriber &sub) { return sub.address == source; });
+    if (it == subscribers.end()) {
+        if (subscribers.size() == osc_subscribers_max)
+            return reply_error(source, "/adljack/subscribe", "too many subscribers");
+        // the stream starts with the events which follow
+        if (subscribers.empty()) {
+            notification_cursor.event = ::notification_bus.subscribe().event;
+            set_channel_description(true);
+        }
+        subscribers.emplace_back();
+        it = subscribers.end() - 1;
+        it->address = source;
+    }
+    it->interval = stc::duration_cast<stc::steady_clock::duration>(stc::duration<double>(1 / rate));
+    it->next = stc::steady_clock::now();
+}
+
+void Osc_Control::Impl::unsubscribe(const Osc_Address &source)
+{
+    auto it = std::find_if(subscribers.begin(), subscribers.end(),
+                           [&source](const Osc_Subscriber &sub) { return sub.address == source; });
+    if (it == subscribers.end())
+        return;
+    subscribers.erase(it);
+    if (subscribers.empty())
+        set_channel_description(false);
+}
+
+void Osc_Control::Impl::stream(stc::steady_clock::time_point now)
+{
+    if (subscribers.empty())
+        return;
+
+    // the events go to all the subscribers, as soon as they are seen
+    Notification_Bus &bus = ::notification_bus;
+    Notification_Event event;
+    while (bus.next(notification_cursor, event)) {
+        if (event.type != Notify_TextInsert)
+            continue;
+        lo_message msg = lo_message_new();
+        lo_message_add_string(msg, std::string((const char *)event.data, event.size).c_str());
+        for (const Osc_Subscriber &sub : subscribers)
+            send(sub.address, "/adljack/text", msg);
+        lo_message_free(msg);
+    }
+
+    // the letters of the last description of the voices
+    bus.get(notification_cursor, Notify_Channels, channels);
+    std::string occupancy((const char *)channels.data, channels.size / 2);
+
+    lo_message meter = nullptr;
+    lo_message voices = nullptr;
+    lo_message occupied = nullptr;
+    Audio_Snapshot snapshot;
+
+    for (Osc_Subscriber &sub : subscribers) {
+        if (sub.next > now)
+            continue;
+        sub.next = std::max(sub.next + sub.interval, now);
+
+        if (!meter) {
+            read_audio_snapshot(snapshot);
+            meter = lo_message_new();
+            lo_message_add_float(meter, snapshot.lvcurrent[0]);
+            lo_message_add_float(meter, snapshot.lvcurrent[1]);
+            lo_message_add_float(meter, snapshot.cpuratio);
+            voices = lo_message_new();
+            for (unsigned ch = 0; ch < 16; ++ch)
+                lo_message_add_int32(voices, snapshot.note_count[ch]);
+            occupied = lo_message_new();
+            lo_message_add_string(occupied, occupancy.c_str());
+        }
+        send(sub.address, "/adljack/meter", meter);
+        send(sub.address, "/adljack/voices", voices);
+        if (!occupancy.empty())
+            send(sub.address, "/adljack/channels", occupied);
+    }
+
+    if (meter) {
+        lo_message_free(meter);
+        lo_message_free(voices);
+        lo_message_free(occupied);
+    }
+}
+
+void Osc_Control::Impl::send(const Osc_Address &to, const char *path, lo_message msg)
+{
+    uint8_t packet[osc_packet_max];
+    size_t size = lo_message_length(msg, path);
+    if (size > sizeof(packet))
+        return;
+    lo_message_serialise(msg, path, packet, &size);
+    sendto(fd, packet, size, 0, (const sockaddr *)&to.addr, to.len);
+}
+
+void Osc_Control::Impl::reply_error(const Osc_Address &to, const char *path, const char *reason)
+{
+    lo_message msg = lo_message_new();
+    lo_message_add_string(msg, path);
+    lo_message_add_string(msg, reason);
+    send(to, "/adljack/error", msg);
+    lo_message_free(msg);
+}
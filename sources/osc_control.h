@@ -0,0 +1,29 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <memory>
+
+// An OSC server on UDP, which receives the methods under "/adljack" on its
+// own thread. The programs of the channels go to the audio side by a queue,
+// and the other commands wait for the interface to process them, to apply
+// the same way as its own. The subscribers receive the levels and the
+// activity of the channels at the rate they request.
+class Osc_Control {
+public:
+    Osc_Control();
+    ~Osc_Control();
+
+    // listen on the port, at the address of the local host if none
+    bool start(const char *address, const char *port);
+    void stop();
+
+    // on the interface side, apply the commands which were received
+    void process();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> P;
+};
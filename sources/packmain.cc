@@ -0,0 +1,137 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "bank.h"
+#include "common.h"
+#include <string>
+#include <getopt.h>
+#include <stdio.h>
+#if defined(_WIN32)
+#    include <windows.h>
+#else
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+// Converts WOPL and WOPN bank files into the packed format, which adljack
+// maps into memory and uses without parsing.
+
+static void usage()
+{
+    fprintf(stderr, "Usage:\n    adlpack [-h] input.wopl|input.wopn output.bank\n"
+                    "    adlpack [-h] -E player output.bank\n");
+}
+
+// write the file under a temporary name in the same directory, and put it in
+// place of the output at once. the instances which map the previous version
+// keep it, truncating it would kill them.
+static bool write_file_replacing(const char *path, const std::vector<uint8_t> &data)
+{
+    std::string temp = std::string(path) + ".XXXXXX";
+#if defined(_WIN32)
+    temp.resize(temp.size() - 6);
+    temp += "tmp";
+    FILE_u stream(fopen(temp.c_str(), "wb"));
+#else
+    int fd = mkstemp(&temp[0]);
+    // readable by all, like a file which fopen creates
+    if (fd != -1)
+        fchmod(fd, 0644);
+    FILE_u stream((fd != -1) ? fdopen(fd, "wb") : nullptr);
+    if (fd != -1 && !stream)
+        close(fd);
+#endif
+    if (!stream)
+        return false;
+
+    bool success = fwrite(data.data(), 1, data.size(), stream.get()) == data.size() &&
+        fflush(stream.get()) == 0;
+#if !defined(_WIN32)
+    success = success && fsync(fileno(stream.get())) == 0;
+#endif
+    success = fclose(stream.release()) == 0 && success;
+
+#if defined(_WIN32)
+    success = success && MoveFileExA(temp.c_str(), path, MOVEFILE_REPLACE_EXISTING);
+#else
+    success = success && rename(temp.c_str(), path) == 0;
+#endif
+    if (!success)
+        remove(temp.c_str());
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    Player_Type embedded_type = (Player_Type)-1;
+
+    for (int c; (c = getopt(argc, argv, "hE:")) != -1;) {
+        switch (c) {
+        case 'E':
+            embedded_type = Player::type_by_name(optarg);
+            if (embedded_type == (Player_Type)-1) {
+                fprintf(stderr, "Invalid player name.\n");
+                return 1;
+            }
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    bool embedded = embedded_type != (Player_Type)-1;
+    if (argc - optind != (embedded ? 1 : 2)) {
+        usage();
+        return 1;
+    }
+
+    const char *output = argv[argc - 1];
+
+    Player_Type pt;
+    std::vector<uint8_t> data;
+    if (embedded) {
+        pt = embedded_type;
+        size_t size;
+        const uint8_t *embedded_data = Player::embedded_bank_data(pt, 0, &size);
+        if (!embedded_data) {
+            fprintf(stderr, "The player has no embedded bank file.\n");
+            return 1;
+        }
+        data.assign(embedded_data, embedded_data + size);
+    }
+    else {
+        if (!read_bank_file(argv[optind], data)) {
+            fprintf(stderr, "Cannot read the bank file.\n");
+            return 1;
+        }
+        pt = Bank::type_of(data.data(), data.size());
+        if (pt == (Player_Type)-1 || Bank::is_packed(data.data(), data.size())) {
+            fprintf(stderr, "The input is not a WOPL or WOPN bank file.\n");
+            return 1;
+        }
+    }
+
+    std::unique_ptr<Player> player(Player::create(pt, 44100));
+    Bank bank;
+    if (!player || !bank.load(*player, std::move(data))) {
+        fprintf(stderr, "Cannot load the bank file.\n");
+        return 1;
+    }
+
+    std::vector<uint8_t> image;
+    bank.save_packed(image);
+
+    if (!write_file_replacing(output, image)) {
+        fprintf(stderr, "Cannot write the output file.\n");
+        return 1;
+    }
+
+    fprintf(stderr, "%s: %u banks, %zu bytes.\n", Player::name(pt), bank.bank_count(), image.size());
+    return 0;
+}
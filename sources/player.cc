@@ -4,6 +4,7 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "player.h"
+#include "bank.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -67,17 +68,29 @@ double Player::output_gain(Player_Type pt)
     }
 }
 
-auto Player::enumerate_emulators(Player_Type pt) -> std::vector<Emulator>
+static unsigned emulator_cost(Player_Type pt, const char *name)
 {
-    std::vector<Emulator> emus;
+    switch (pt) {
+    default: assert(false); abort();
+    #define PLAYER_CASE(x)                                                  \
+        case Player_Type::x: return Player_Traits<Player_Type::x>::emulator_cost(name);
+    EACH_PLAYER_TYPE(PLAYER_CASE);
+    #undef PLAYER_CASE
+    }
+}
+
+static std::vector<Player::Emulator> probe_emulators(Player_Type pt)
+{
+    std::vector<Player::Emulator> emus;
     emus.reserve(32);
 
-    std::unique_ptr<Player> player(create(pt, 44100));
-    for (unsigned i = 0; i < 32; ++i) {
+    std::unique_ptr<Player> player(Player::create(pt, 44100));
+    for (unsigned i = 0; player && i < 32; ++i) {
         if (player->set_emulator(i)) {
-            Emulator emu;
+            Player::Emulator emu;
             emu.id = i;
             emu.name = player->emulator_name();
+            emu.cost = emulator_cost(pt, emu.name);
             emus.push_back(emu);
         }
     }
@@ -85,15 +98,57 @@ auto Player::enumerate_emulators(Player_Type pt) -> std::vector<Emulator>
     return emus;
 }
 
+auto Player::enumerate_emulators(Player_Type pt) -> const std::vector<Emulator> &
+{
+    static std::vector<Emulator> registry[player_type_count];
+    static std::once_flag probed[player_type_count];
+
+    unsigned index = (unsigned)pt;
+    std::call_once(probed[index], [pt]() { registry[(unsigned)pt] = probe_emulators(pt); });
+    return registry[index];
+}
+
 unsigned Player::emulator_by_name(Player_Type pt, const char *name)
 {
-    std::vector<Emulator> emus = enumerate_emulators(pt);
-    for (unsigned i = 0, n = emus.size(); i < n; ++i)
-        if (!strcmp(emus[i].name, name))
-            return i;
+    for (const Emulator &emu : enumerate_emulators(pt))
+        if (!strcmp(emu.name, name))
+            return emu.id;
     return (unsigned)-1;
 }
 
+size_t Player::instrument_size(Player_Type pt)
+{
+    switch (pt) {
+    default: assert(false); abort();
+    #define PLAYER_CASE(x)                                                  \
+        case Player_Type::x: return sizeof(Player_Traits<Player_Type::x>::instrument);
+    EACH_PLAYER_TYPE(PLAYER_CASE);
+    #undef PLAYER_CASE
+    }
+}
+
+size_t Player::bank_header_size(Player_Type pt)
+{
+    switch (pt) {
+    default: assert(false); abort();
+    #define PLAYER_CASE(x)                                                  \
+        case Player_Type::x: return Player_Traits<Player_Type::x>::bank_header_size;
+    EACH_PLAYER_TYPE(PLAYER_CASE);
+    #undef PLAYER_CASE
+    }
+}
+
+const uint8_t *Player::embedded_bank_data(Player_Type pt, unsigned bank, size_t *size)
+{
+    switch (pt) {
+    default: assert(false); abort();
+    #define PLAYER_CASE(x)                                                  \
+        case Player_Type::x: return Player_Traits<Player_Type::x>::embedded_bank_data(bank, size);
+    EACH_PLAYER_TYPE(PLAYER_CASE);
+    #undef PLAYER_CASE
+    }
+}
+
 Player_Type Player::type_by_name(const char *nam)
 {
     for (Player_Type pt : all_player_types)
@@ -125,8 +180,161 @@ bool Player::dynamic_load_bank(const char *bankfile)
     return true;
 }
 
+bool Player::dynamic_load_bank_data(const void *data, size_t size)
+{
+    auto lock = take_lock();
+    panic();
+    if (!load_bank_data(data, size))
+        return false;
+    return true;
+}
+
+bool Player::dynamic_load_bank(const std::shared_ptr<const Bank> &bank)
+{
+    auto lock = take_lock();
+    panic();
+    if (!load_bank(bank))
+        return false;
+    return true;
+}
+
+bool Player::load_bank(const std::shared_ptr<const Bank> &bank)
+{
+    if (!load_bank_data(bank->data(), bank->size()))
+        return false;
+    bank_ = bank;
+    return true;
+}
+
 void Player::dynamic_panic()
 {
     auto lock = take_lock();
     panic();
 }
+
+bool Player::decode_event(const uint8_t *msg, unsigned len, Event &event)
+{
+    if (len < 2)
+        return false;
+
+    uint8_t status = msg[0];
+    event.channel = status & 0x0f;
+    event.key = msg[1] & 0x7f;
+    event.value = (len > 2) ? (msg[2] & 0x7f) : 0;
+
+    switch (status >> 4) {
+    case 0b1001:
+        if (len < 3) return false;
+        event.type = (event.value != 0) ? Event::Note_On : Event::Note_Off;
+        return true;
+    case 0b1000:
+        if (len < 3) return false;
+        event.type = Event::Note_Off;
+        return true;
+    case 0b1010:
+        if (len < 3) return false;
+        event.type = Event::Note_Aftertouch;
+        return true;
+    case 0b1101:
+        event.type = Event::Channel_Aftertouch;
+        event.value = event.key;
+        return true;
+    case 0b1011:
+        if (len < 3) return false;
+        event.type = Event::Controller;
+        return true;
+    case 0b1100:
+        event.type = Event::Program;
+        event.value = event.key;
+        return true;
+    case 0b1110:
+        if (len < 3) return false;
+        event.type = Event::Pitchbend;
+        event.value = event.key | (event.value << 7);
+        return true;
+    default:
+        return false;
+    }
+}
+
+template <Player_Type Pt>
+void Generic_Player<Pt>::rt_events(const Event *events, size_t count)
+{
+    // call the library directly, without a virtual call per event
+    player_t *player = player_.get();
+    for (size_t i = 0; i < count; ++i) {
+        const Event &ev = events[i];
+        switch (ev.type) {
+        case Event::Note_Off:
+            Traits::rt_note_off(player, ev.channel, ev.key); break;
+        case Event::Note_On:
+            Traits::rt_note_on(player, ev.channel, ev.key, ev.value); break;
+        case Event::Note_Aftertouch:
+            Traits::rt_note_aftertouch(player, ev.channel, ev.key, ev.value); break;
+        case Event::Channel_Aftertouch:
+            Traits::rt_channel_aftertouch(player, ev.channel, ev.value); break;
+        case Event::Controller:
+            Traits::rt_controller_change(player, ev.channel, ev.key, ev.value); break;
+        case Event::Program:
+            Traits::rt_program_change(player, ev.channel, ev.value); break;
+        case Event::Pitchbend:
+            Traits::rt_pitchbend(player, ev.channel, ev.value); break;
+        }
+    }
+}
+
+template <Player_Type Pt>
+bool Generic_Player<Pt>::get_instruments(std::vector<Bank_Id> &ids, std::vector<uint8_t> &data)
+{
+    typedef typename Traits::instrument instrument_t;
+    player_t *player = player_.get();
+
+    ids.clear();
+    data.clear();
+
+    typename Traits::bank bank;
+    if (Traits::get_first_bank(player, &bank) < 0)
+        return true;
+
+    do {
+        typename Traits::bank_id bid;
+        if (Traits::get_bank_id(player, &bank, &bid) < 0)
+            return false;
+        Bank_Id id;
+        id.percussive = bid.percussive;
+        id.msb = bid.msb;
+        id.lsb = bid.lsb;
+        ids.push_back(id);
+
+        // zero-filled, so the padding compares equal
+        size_t offset = data.size();
+        data.resize(offset + 128 * sizeof(instrument_t));
+        instrument_t *ins = (instrument_t *)&data[offset];
+        for (unsigned i = 0; i < 128; ++i) {
+            if (Traits::get_instrument(player, &bank, i, &ins[i]) < 0)
+                return false;
+        }
+    } while (Traits::get_next_bank(player, &bank) >= 0);
+
+    return true;
+}
+
+template <Player_Type Pt>
+bool Generic_Player<Pt>::set_instrument(const Bank_Id &id, unsigned index, const void *data)
+{
+    typedef typename Traits::instrument instrument_t;
+    player_t *player = player_.get();
+
+    typename Traits::bank_id bid;
+    bid.percussive = id.percussive;
+    bid.msb = id.msb;
+    bid.lsb = id.lsb;
+
+    typename Traits::bank bank;
+    if (Traits::get_bank(player, &bid, 0, &bank) < 0)
+        return false;
+
+    instrument_t ins;
+    memcpy(&ins, data, sizeof(instrument_t));
+    return Traits::set_instrument(player, &bank, index, &ins) >= 0;
+}
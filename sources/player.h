@@ -10,6 +10,8 @@
 #include <memory>
 #include <mutex>
 
+class Bank;
+
 class Player {
 protected:
     Player() {}
@@ -30,12 +32,47 @@ public:
     struct Emulator {
         unsigned id = (unsigned)-1;
         const char *name = nullptr;
+        // relative processing cost, from 1 (light) to 4 (heavy), 0 if unknown
+        unsigned cost = 0;
         operator bool() const { return id != (unsigned)-1; }
     };
 
-    static std::vector<Emulator> enumerate_emulators(Player_Type pt);
+    // the emulators are probed once, on first use
+    static const std::vector<Emulator> &enumerate_emulators(Player_Type pt);
     static unsigned emulator_by_name(Player_Type pt, const char *name);
 
+    struct Bank_Id {
+        unsigned percussive = 0;
+        unsigned msb = 0;
+        unsigned lsb = 0;
+    };
+
+    // a channel event, decoded ahead of dispatch
+    struct Event {
+        enum Type : uint8_t {
+            Note_Off,
+            Note_On,
+            Note_Aftertouch,
+            Channel_Aftertouch,
+            Controller,
+            Program,
+            Pitchbend,
+        };
+        Type type;
+        uint8_t channel;
+        // the note or the controller
+        uint8_t key;
+        uint16_t value;
+    };
+
+    // decode a channel message, false if it is not one
+    static bool decode_event(const uint8_t *msg, unsigned len, Event &event);
+
+    static size_t instrument_size(Player_Type pt);
+    static size_t bank_header_size(Player_Type pt);
+    // the bank file of an embedded bank, if the library does not own it
+    static const uint8_t *embedded_bank_data(Player_Type pt, unsigned bank, size_t *size);
+
     const char *name() const
         { return name(type()); }
     const char *version() const
@@ -44,7 +81,7 @@ public:
         { return chip_name(type()); }
     double output_gain() const
         { return output_gain(type()); }
-    std::vector<Emulator> enumerate_emulators() const
+    const std::vector<Emulator> &enumerate_emulators() const
         { return enumerate_emulators(type()); }
     unsigned emulator_by_name(const char *name) const
         { return emulator_by_name(type(), name); }
@@ -63,6 +100,14 @@ public:
     virtual bool set_chip_count(unsigned count) = 0;
     virtual bool load_bank_file(const char *file) = 0;
     virtual bool load_bank_data(const void *data, size_t size) = 0;
+    // get the instruments of all banks, as 128 entries of instrument_size per bank
+    virtual bool get_instruments(std::vector<Bank_Id> &ids, std::vector<uint8_t> &data) = 0;
+    virtual bool set_instrument(const Bank_Id &id, unsigned index, const void *data) = 0;
+    bool load_bank(const std::shared_ptr<const Bank> &bank);
+    // the bank which is loaded, if it was loaded by `load_bank`
+    const std::shared_ptr<const Bank> &bank() const { return bank_; }
+    // record the bank as loaded, after its contents were applied otherwise
+    void set_loaded_bank(const std::shared_ptr<const Bank> &bank) { bank_ = bank; }
     virtual void generate(unsigned nframes, void *left, void *right, const Audio_Format &format) = 0;
     virtual void describe_channels(char *text, char *attr, size_t size) = 0;
     virtual void rt_note_on(unsigned chan, unsigned note, unsigned vel) = 0;
@@ -74,10 +119,14 @@ public:
     virtual void rt_pitchbend(unsigned chan, unsigned value) = 0;
     virtual void rt_bank_change_msb(unsigned chan, unsigned value) = 0;
     virtual void rt_bank_change_lsb(unsigned chan, unsigned value) = 0;
+    // dispatch a sequence of events, under the lock of the caller
+    virtual void rt_events(const Event *events, size_t count) = 0;
 
     bool dynamic_set_chip_count(unsigned nchip);
     bool dynamic_set_emulator(unsigned emulator);
     bool dynamic_load_bank(const char *bankfile);
+    bool dynamic_load_bank_data(const void *data, size_t size);
+    bool dynamic_load_bank(const std::shared_ptr<const Bank> &bank);
     void dynamic_panic();
 
     std::unique_lock<std::mutex> take_lock()
@@ -88,6 +137,7 @@ public:
 protected:
     unsigned sample_rate_ = 0;
     unsigned emulator_ = 0;
+    std::shared_ptr<const Bank> bank_;
     std::mutex mutex_;
 };
 
@@ -131,13 +181,15 @@ public:
             return Traits::set_num_chips(player_.get(), count) >= 0 && chip_count() == count;
         }
     bool set_embedded_bank(unsigned bank) override
-        { return Traits::set_bank(player_.get(), bank) >= 0; }
+        { bank_.reset(); return Traits::set_bank(player_.get(), bank) >= 0; }
     void set_soft_pan_enabled(bool sp) override
         { return Traits::set_soft_pan_enabled(player_.get(), sp); }
     bool load_bank_file(const char *file) override
-        { return Traits::open_bank_file(player_.get(), file) >= 0; }
+        { bank_.reset(); return Traits::open_bank_file(player_.get(), file) >= 0; }
     bool load_bank_data(const void *data, size_t size) override
-        { return Traits::open_bank_data(player_.get(), data, size) >= 0; }
+        { bank_.reset(); return Traits::open_bank_data(player_.get(), data, size) >= 0; }
+    bool get_instruments(std::vector<Bank_Id> &ids, std::vector<uint8_t> &data) override;
+    bool set_instrument(const Bank_Id &id, unsigned index, const void *data) override;
     void generate(unsigned nframes, void *left, void *right, const Audio_Format &format) override
         { Traits::generate_format(player_.get(), 2 * nframes, (ADL_UInt8 *)left, (ADL_UInt8 *)right, &(typename Traits::audio_format &)format); }
     void describe_channels(char *text, char *attr, size_t size) override
@@ -160,4 +212,5 @@ public:
         { Traits::rt_bank_change_msb(player_.get(), chan, value); }
     void rt_bank_change_lsb(unsigned chan, unsigned value) override
         { Traits::rt_bank_change_lsb(player_.get(), chan, value); }
+    void rt_events(const Event *events, size_t count) override;
 };
@@ -5,16 +5,70 @@
 
 #include "player_traits.h"
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 
+struct Emulator_Cost {
+    const char *name_prefix;
+    unsigned cost;
+};
+
+template <size_t N>
+static unsigned find_emulator_cost(const Emulator_Cost (&table)[N], const char *name)
+{
+    for (const Emulator_Cost &entry : table)
+        if (!strncmp(name, entry.name_prefix, strlen(entry.name_prefix)))
+            return entry.cost;
+    return 0;
+}
+
 const double Player_Traits<Player_Type::OPL3>::output_gain = pow(10.0, 3.0 / 20.0);
 
+unsigned Player_Traits<Player_Type::OPL3>::emulator_cost(const char *name)
+{
+    static const Emulator_Cost table[] = {
+        { "Nuked", 4 },
+        { "Java", 2 },
+        { "DosBox", 1 },
+        { "DOSBox", 1 },
+        { "Opal", 1 },
+    };
+    return find_emulator_cost(table, name);
+}
+
+unsigned Player_Traits<Player_Type::OPN2>::emulator_cost(const char *name)
+{
+    static const Emulator_Cost table[] = {
+        { "Nuked", 4 },
+        { "Genesis Plus", 2 },
+        { "MAME", 2 },
+        { "NP2", 2 },
+        { "PMDWin", 2 },
+        { "GENS", 1 },
+    };
+    return find_emulator_cost(table, name);
+}
+
 int Player_Traits<Player_Type::OPN2>::set_bank(player *pl, unsigned bank)
+{
+    size_t size;
+    const uint8_t *data = embedded_bank_data(bank, &size);
+    return (!data) ? -1 :
+        open_bank_data(pl, data, size);
+}
+
+// with packed embedded banks, the bank file is taken from the packed image,
+// in embedded_bank.cc, so the program does not hold it twice
+#if !defined(ADLJACK_PACKED_EMBEDDED_BANKS)
+const uint8_t *Player_Traits<Player_Type::OPN2>::embedded_bank_data(unsigned bank, size_t *size)
 {
     #pragma message("Using my own bank embed for OPN2. Remove this in the future.")
     static const uint8_t bankdata[] = {
         #include "embedded-banks/opn2.h"
     };
-    return (bank != 0) ? -1 :
-        open_bank_data(pl, bankdata, sizeof(bankdata));
+    if (bank != 0)
+        return nullptr;
+    *size = sizeof(bankdata);
+    return bankdata;
 }
+#endif
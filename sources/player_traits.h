@@ -39,14 +39,22 @@ struct Player_Traits<Player_Type::OPL3>
     typedef ADL_MIDIPlayer player;
     typedef ADLMIDI_AudioFormat audio_format;
     typedef ADLMIDI_SampleType sample_type;
+    typedef ADL_Bank bank;
+    typedef ADL_BankId bank_id;
+    typedef ADL_Instrument instrument;
 
     static const char *name() { return "ADLMIDI"; }
     static const char *chip_name() { return "YMF262"; }
 
     static constexpr unsigned channels_per_chip = 23;
 
+    // size of the WOPL header, which holds the global settings of the bank
+    static constexpr unsigned bank_header_size = 19;
+
     static const double output_gain;
 
+    static unsigned emulator_cost(const char *name);
+
     static constexpr auto &version = adl_linkedLibraryVersion;
     static constexpr auto &init = adl_init;
     static constexpr auto &close = adl_close;
@@ -58,6 +66,8 @@ struct Player_Traits<Player_Type::OPL3>
     static constexpr auto &get_num_chips = adl_getNumChips;
     static constexpr auto &set_num_chips = adl_setNumChips;
     static constexpr auto &set_bank = adl_setBank;
+    // the embedded banks are internal to the library
+    static const uint8_t *embedded_bank_data(unsigned, size_t *) { return nullptr; }
     static constexpr auto &open_bank_file = adl_openBankFile;
     static constexpr auto &open_bank_data = adl_openBankData;
     static constexpr auto &generate = adl_generate;
@@ -72,6 +82,12 @@ struct Player_Traits<Player_Type::OPL3>
     static constexpr auto &rt_pitchbend = adl_rt_pitchBend;
     static constexpr auto &rt_bank_change_msb = adl_rt_bankChangeMSB;
     static constexpr auto &rt_bank_change_lsb = adl_rt_bankChangeLSB;
+    static constexpr auto &get_bank = adl_getBank;
+    static constexpr auto &get_bank_id = adl_getBankId;
+    static constexpr auto &get_first_bank = adl_getFirstBank;
+    static constexpr auto &get_next_bank = adl_getNextBank;
+    static constexpr auto &get_instrument = adl_getInstrument;
+    static constexpr auto &set_instrument = adl_setInstrument;
 };
 
 #include <opnmidi.h>
@@ -82,14 +98,22 @@ struct Player_Traits<Player_Type::OPN2>
     typedef OPN2_MIDIPlayer player;
     typedef OPNMIDI_AudioFormat audio_format;
     typedef OPNMIDI_SampleType sample_type;
+    typedef OPN2_Bank bank;
+    typedef OPN2_BankId bank_id;
+    typedef OPN2_Instrument instrument;
 
     static const char *name() { return "OPNMIDI"; }
     static const char *chip_name() { return "YM2612"; }
 
     static constexpr unsigned channels_per_chip = 6;
 
+    // size of the WOPN header, which holds the global settings of the bank
+    static constexpr unsigned bank_header_size = 18;
+
     static constexpr double output_gain = 1.0;
 
+    static unsigned emulator_cost(const char *name);
+
     static constexpr auto &version = opn2_linkedLibraryVersion;
     static constexpr auto &init = opn2_init;
     static constexpr auto &close = opn2_close;
@@ -101,6 +125,7 @@ struct Player_Traits<Player_Type::OPN2>
     static constexpr auto &get_num_chips = opn2_getNumChips;
     static constexpr auto &set_num_chips = opn2_setNumChips;
     static int set_bank(player *pl, unsigned bank);
+    static const uint8_t *embedded_bank_data(unsigned bank, size_t *size);
     static constexpr auto &open_bank_file = opn2_openBankFile;
     static constexpr auto &open_bank_data = opn2_openBankData;
     static constexpr auto &generate = opn2_generate;
@@ -115,4 +140,10 @@ struct Player_Traits<Player_Type::OPN2>
     static constexpr auto &rt_pitchbend = opn2_rt_pitchBend;
     static constexpr auto &rt_bank_change_msb = opn2_rt_bankChangeMSB;
     static constexpr auto &rt_bank_change_lsb = opn2_rt_bankChangeLSB;
+    static constexpr auto &get_bank = opn2_getBank;
+    static constexpr auto &get_bank_id = opn2_getBankId;
+    static constexpr auto &get_first_bank = opn2_getFirstBank;
+    static constexpr auto &get_next_bank = opn2_getNextBank;
+    static constexpr auto &get_instrument = opn2_getInstrument;
+    static constexpr auto &set_instrument = opn2_setInstrument;
 };
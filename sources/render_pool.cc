@@ -0,0 +1,137 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "render_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#if defined(ADLJACK_HAVE_POSIX_SEMAPHORE)
+#include <semaphore.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct Render_Pool::Impl {
+    Job *job = nullptr;
+    void *const *data = nullptr;
+    unsigned count = 0;
+    std::atomic<unsigned> next{0};
+
+    void work();
+
+#if defined(ADLJACK_HAVE_POSIX_SEMAPHORE)
+    struct Worker {
+        pthread_t thread;
+        sem_t start;
+        Impl *pool = nullptr;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    sem_t done;
+    std::atomic<bool> quit{false};
+
+    static void *worker_main(void *arg);
+#endif
+};
+
+Render_Pool::Render_Pool(unsigned nthreads)
+    : P(new Impl)
+{
+#if defined(ADLJACK_HAVE_POSIX_SEMAPHORE)
+    sem_init(&P->done, 0, 0);
+    for (unsigned i = 0; i < nthreads; ++i) {
+        std::unique_ptr<Impl::Worker> worker(new Impl::Worker);
+        worker->pool = P.get();
+        sem_init(&worker->start, 0, 0);
+        if (pthread_create(&worker->thread, nullptr, &Impl::worker_main, worker.get()) != 0) {
+            sem_destroy(&worker->start);
+            break;
+        }
+        P->workers.push_back(std::move(worker));
+    }
+#else
+    (void)nthreads;
+#endif
+}
+
+Render_Pool::~Render_Pool()
+{
+#if defined(ADLJACK_HAVE_POSIX_SEMAPHORE)
+    P->quit.store(true);
+    for (const std::unique_ptr<Impl::Worker> &worker : P->workers) {
+        sem_post(&worker->start);
+        pthread_join(worker->thread, nullptr);
+        sem_destroy(&worker->start);
+    }
+    sem_destroy(&P->done);
+#endif
+}
+
+unsigned Render_Pool::thread_count() const
+{
+#if defined(ADLJACK_HAVE_POSIX_SEMAPHORE)
+    return P->workers.size();
+#else
+    return 0;
+#endif
+}
+
+bool Render_Pool::set_priority(int priority)
+{
+#if defined(ADLJACK_HAVE_POSIX_SEMAPHORE)
+    bool success = true;
+    sched_param param = {};
+    param.sched_priority = priority;
+    int policy = (priority > 0) ? SCHED_FIFO : SCHED_OTHER;
+    for (const std::unique_ptr<Impl::Worker> &worker : P->workers)
+        success = pthread_setschedparam(worker->thread, policy, &param) == 0 && success;
+    return success;
+#else
+    (void)priority;
+    return false;
+#endif
+}
+
+void Render_Pool::run(Job *job, void *const data[], unsigned count)
+{
+    Impl &impl = *P;
+    impl.job = job;
+    impl.data = data;
+    impl.count = count;
+    impl.next.store(0, std::memory_order_relaxed);
+
+#if defined(ADLJACK_HAVE_POSIX_SEMAPHORE)
+    // wake as many threads as there are jobs besides the own
+    unsigned nwake = std::min<unsigned>(impl.workers.size(), count ? (count - 1) : 0);
+    for (unsigned i = 0; i < nwake; ++i)
+        sem_post(&impl.workers[i]->start);
+    impl.work();
+    for (unsigned i = 0; i < nwake; ++i)
+        while (sem_wait(&impl.done) != 0);
+#else
+    impl.work();
+#endif
+}
+
+void Render_Pool::Impl::work()
+{
+    for (unsigned i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;)
+        job(data[i]);
+}
+
+#if defined(ADLJACK_HAVE_POSIX_SEMAPHORE)
+void *Render_Pool::Impl::worker_main(void *arg)
+{
+    Worker &worker = *(Worker *)arg;
+    Impl &impl = *worker.pool;
+    for (;;) {
+        while (sem_wait(&worker.start) != 0);
+        if (impl.quit.load())
+            break;
+        impl.work();
+        sem_post(&impl.done);
+    }
+    return nullptr;
+}
+#endif
@@ -0,0 +1,30 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <memory>
+
+// Threads which run jobs of the audio thread in parallel with it. The audio
+// thread wakes the threads, takes part in the jobs, and waits until all are
+// done. The threads only wait on semaphores, there is no lock involved.
+// Where semaphores are not supported, the audio thread runs all the jobs.
+class Render_Pool {
+public:
+    typedef void (Job)(void *data);
+
+    explicit Render_Pool(unsigned nthreads);
+    ~Render_Pool();
+
+    unsigned thread_count() const;
+    // give the threads the real-time priority of the audio, if not zero
+    bool set_priority(int priority);
+
+    // run the job for each of the data, and return when all have finished
+    void run(Job *job, void *const data[], unsigned count);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> P;
+};
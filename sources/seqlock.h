@@ -0,0 +1,93 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <atomic>
+#include <type_traits>
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+
+// A value which one thread writes without waiting, and which any number of
+// threads read. A reader copies the value again if it was being written.
+// The value is kept in atomic words, so the copies are not data races.
+template <class T>
+class Seqlock {
+public:
+    static_assert(std::is_trivially_copyable<T>::value, "the value must be trivially copyable");
+
+    Seqlock();
+
+    // on the writer side, replace the first bytes of the value, the other
+    // ones keeping their contents
+    void store(const T &value, size_t size = sizeof(T));
+
+    // copy the value, and get its number, which increases with every store
+    unsigned long load(T &value) const;
+    // the number of the last value, without copying it
+    unsigned long sequence() const;
+
+private:
+    typedef uintptr_t word_type;
+    static constexpr size_t word_count = (sizeof(T) + sizeof(word_type) - 1) / sizeof(word_type);
+    // odd while writing
+    std::atomic<unsigned long> seq_{0};
+    std::atomic<word_type> words_[word_count];
+};
+
+template <class T>
+Seqlock<T>::Seqlock()
+{
+    for (std::atomic<word_type> &word : words_)
+        word.store(0, std::memory_order_relaxed);
+}
+
+template <class T>
+void Seqlock<T>::store(const T &value, size_t size)
+{
+    const uint8_t *src = (const uint8_t *)&value;
+    size = std::min(size, sizeof(T));
+
+    unsigned long seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0, n = (size + sizeof(word_type) - 1) / sizeof(word_type); i < n; ++i) {
+        word_type word = 0;
+        size_t offset = i * sizeof(word_type);
+        memcpy(&word, src + offset, std::min(sizeof(word_type), sizeof(T) - offset));
+        words_[i].store(word, std::memory_order_relaxed);
+    }
+
+    seq_.store(seq + 2, std::memory_order_release);
+}
+
+template <class T>
+unsigned long Seqlock<T>::load(T &value) const
+{
+    uint8_t *dst = (uint8_t *)&value;
+
+    for (;;) {
+        unsigned long seq = seq_.load(std::memory_order_acquire);
+        if (seq & 1)
+            continue;
+
+        for (size_t i = 0; i < word_count; ++i) {
+            word_type word = words_[i].load(std::memory_order_relaxed);
+            size_t offset = i * sizeof(word_type);
+            memcpy(dst + offset, &word, std::min(sizeof(word_type), sizeof(T) - offset));
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq_.load(std::memory_order_relaxed) == seq)
+            return seq / 2;
+    }
+}
+
+template <class T>
+unsigned long Seqlock<T>::sequence() const
+{
+    return seq_.load(std::memory_order_acquire) / 2;
+}
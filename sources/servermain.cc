@@ -0,0 +1,533 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "synth_instance.h"
+#include "control_socket.h"
+#include "render_pool.h"
+#include "bank_cache.h"
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <system_error>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+// Hosts many synthesizers in one Jack client. Each instance has its own
+// ports, player and channels, and all of them share the parsed banks. The
+// instances render in parallel on the threads of a pool. They are added
+// and removed by commands on a control socket.
+
+namespace stc = std::chrono;
+
+static constexpr unsigned instances_max = 64;
+
+struct Server_Instance {
+    unsigned id = 0;
+    std::unique_ptr<Synth_Instance> synth;
+    jack_port_t *midiport = nullptr;
+    jack_port_t *outport[2] = {};
+    // a player prepared by the control side, and the one it replaced,
+    // which the control side deletes
+    std::atomic<Player *> incoming{nullptr};
+    std::atomic<Player *> outgoing{nullptr};
+    std::atomic<bool> panic_request{false};
+    jack_nframes_t nframes = 0;
+};
+
+static jack_client_t *server_client = nullptr;
+static unsigned server_sample_rate = 0;
+static std::unique_ptr<Bank_Cache> server_bank_cache;
+static std::unique_ptr<Render_Pool> server_render_pool;
+// the instances, by slot, which the audio thread reads
+static std::atomic<Server_Instance *> server_slots[instances_max];
+// the count of finished cycles, to know when the audio has let go of an
+// instance which was removed
+static std::atomic<unsigned> server_cycle{0};
+static unsigned server_next_id = 1;
+
+static Player_Type arg_server_player = Player_Type::OPL3;
+static unsigned arg_server_nchip = default_nchip;
+static unsigned arg_instances = 0;
+static unsigned arg_threads = 0;
+static size_t arg_server_cache_budget = default_bank_cache_budget;
+static std::string arg_socket_path;
+
+static int signal_pipe[2] = {-1, -1};
+
+// the events play at their frame in the period
+static void render_instance(void *data)
+{
+    Server_Instance &inst = *(Server_Instance *)data;
+    Synth_Instance &synth = *inst.synth;
+    jack_nframes_t nframes = inst.nframes;
+
+    // take over the prepared player, once the previous one is collected
+    if (inst.outgoing.load(std::memory_order_acquire) == nullptr) {
+        if (Player *player = inst.incoming.exchange(nullptr, std::memory_order_acq_rel)) {
+            Player *old = synth.exchange_player(std::unique_ptr<Player>(player)).release();
+            inst.outgoing.store(old, std::memory_order_release);
+        }
+    }
+    if (inst.panic_request.exchange(false, std::memory_order_relaxed))
+        synth.panic();
+
+    void *midi = jack_port_get_buffer(inst.midiport, nframes);
+    float *left = (float *)jack_port_get_buffer(inst.outport[0], nframes);
+    float *right = (float *)jack_port_get_buffer(inst.outport[1], nframes);
+
+    unsigned position = 0;
+    for (uint32_t i = 0, n = jack_midi_get_event_count(midi); i < n; ++i) {
+        jack_midi_event_t event;
+        if (jack_midi_event_get(&event, midi, i) != 0)
+            continue;
+        unsigned time = std::min((unsigned)event.time, (unsigned)nframes);
+        if (time > position) {
+            synth.render(left + position, right + position, time - position);
+            position = time;
+        }
+        Player::Event ev;
+        if (Player::decode_event(event.buffer, event.size, ev))
+            synth.play_event(ev);
+    }
+    synth.render(left + position, right + position, nframes - position);
+}
+
+static int process(jack_nframes_t nframes, void *)
+{
+    Server_Instance *active[instances_max];
+    unsigned count = 0;
+    for (unsigned i = 0; i < instances_max; ++i) {
+        Server_Instance *inst = server_slots[i].load(std::memory_order_acquire);
+        if (!inst)
+            continue;
+        inst->nframes = nframes;
+        active[count++] = inst;
+    }
+
+    server_render_pool->run(&render_instance, (void *const *)active, count);
+    server_cycle.fetch_add(1);
+    return 0;
+}
+
+// wait for the audio to finish the cycle under way, or the next one.
+// false if it did not within a second, the audio not running.
+static bool wait_cycle()
+{
+    unsigned cycle = server_cycle.load();
+    for (unsigned i = 0; i < 1000; ++i) {
+        if (server_cycle.load() != cycle)
+            return true;
+        std::this_thread::sleep_for(stc::milliseconds(1));
+    }
+    return false;
+}
+
+static Server_Instance *find_instance(unsigned id, unsigned *slot = nullptr)
+{
+    for (unsigned i = 0; i < instances_max; ++i) {
+        Server_Instance *inst = server_slots[i].load(std::memory_order_relaxed);
+        if (inst && inst->id == id) {
+            if (slot)
+                *slot = i;
+            return inst;
+        }
+    }
+    return nullptr;
+}
+
+// delete the players which the audio has replaced
+static void collect_players()
+{
+    for (unsigned i = 0; i < instances_max; ++i) {
+        Server_Instance *inst = server_slots[i].load(std::memory_order_relaxed);
+        if (inst)
+            delete inst->outgoing.exchange(nullptr, std::memory_order_acq_rel);
+    }
+}
+
+// give the audio a prepared player, once it has taken the previous one.
+// it fails if the audio does not take it within a few cycles.
+static bool offer_player(Server_Instance &inst, std::unique_ptr<Player> player, std::string &reply)
+{
+    for (unsigned attempt = 0;; ++attempt) {
+        Player *expected = nullptr;
+        if (inst.incoming.compare_exchange_strong(expected, player.get(), std::memory_order_acq_rel)) {
+            player.release();
+            return true;
+        }
+        if (attempt == 4) {
+            reply = "busy";
+            return false;
+        }
+        if (!wait_cycle()) {
+            reply = "the audio is not running";
+            return false;
+        }
+        collect_players();
+    }
+}
+
+static bool add_instance(Player_Type pt, unsigned nchip, std::string &reply)
+{
+    unsigned slot = 0;
+    while (slot < instances_max && server_slots[slot].load(std::memory_order_relaxed))
+        ++slot;
+    if (slot == instances_max) {
+        reply = "too many instances";
+        return false;
+    }
+
+    std::unique_ptr<Server_Instance> inst(new Server_Instance);
+    unsigned id = inst->id = server_next_id;
+    Synth_Instance *synth = new Synth_Instance(pt, server_sample_rate, *server_bank_cache);
+    inst->synth.reset(synth);
+
+    Synth_Instance::Setup setup;
+    setup.chip_count = nchip;
+    std::unique_ptr<Player> player = synth->prepare_player(setup);
+    if (!player) {
+        reply = "cannot create the player";
+        return false;
+    }
+    synth->exchange_player(std::move(player));
+    synth->commit_setup(setup);
+
+    jack_client_t *client = ::server_client;
+    std::string prefix = std::to_string(id) + "_";
+    inst->midiport = jack_port_register(client, (prefix + "midi").c_str(), JACK_DEFAULT_MIDI_TYPE, JackPortIsInput|JackPortIsTerminal, 0);
+    inst->outport[0] = jack_port_register(client, (prefix + "left").c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput|JackPortIsTerminal, 0);
+    inst->outport[1] = jack_port_register(client, (prefix + "right").c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput|JackPortIsTerminal, 0);
+    if (!inst->midiport || !inst->outport[0] || !inst->outport[1]) {
+        for (jack_port_t *port : {inst->midiport, inst->outport[0], inst->outport[1]})
+            if (port) jack_port_unregister(client, port);
+        reply = "cannot create the ports";
+        return false;
+    }
+
+    ++server_next_id;
+    server_slots[slot].store(inst.release(), std::memory_order_release);
+    reply = std::to_string(id);
+    return true;
+}
+
+static bool remove_instance(unsigned id, std::string &reply)
+{
+    unsigned slot;
+    Server_Instance *inst = find_instance(id, &slot);
+    if (!inst) {
+        reply = "no such instance";
+        return false;
+    }
+
+    // the audio lets go of it at the end of the cycle which has read the
+    // slot. without a cycle, it is kept, as the audio might hold it yet.
+    server_slots[slot].store(nullptr);
+    if (!wait_cycle()) {
+        server_slots[slot].store(inst);
+        reply = "the audio is not running";
+        return false;
+    }
+
+    jack_client_t *client = ::server_client;
+    for (jack_port_t *port : {inst->midiport, inst->outport[0], inst->outport[1]})
+        jack_port_unregister(client, port);
+    delete inst->incoming.load(std::memory_order_relaxed);
+    delete inst->outgoing.load(std::memory_order_relaxed);
+    delete inst;
+    return true;
+}
+
+static std::string describe_instance(const Server_Instance &inst)
+{
+    const Synth_Instance &synth = *inst.synth;
+    Synth_Instance::Setup setup = synth.setup();
+    Player_Type pt = synth.player_type();
+
+    const char *emulator_name = "";
+    for (const Player::Emulator &emu : Player::enumerate_emulators(pt)) {
+        if (emu.id == setup.emulator)
+            emulator_name = emu.name;
+    }
+
+    char text[256];
+    snprintf(text, sizeof(text), "%u %s \"%s\" chips=%u volume=%d bank=",
+             inst.id, Player::name(pt), emulator_name, setup.chip_count, synth.volume());
+    return text + (setup.bank_file.empty() ? std::string("(embedded)") : setup.bank_file);
+}
+
+static bool parse_unsigned(const std::string &text, unsigned &value)
+{
+    char *end;
+    unsigned long number = strtoul(text.c_str(), &end, 10);
+    if (text.empty() || *end || number > UINT_MAX)
+        return false;
+    value = number;
+    return true;
+}
+
+static const char server_help[] =
+    "add [player] [chips]\n"
+    "remove <id>\n"
+    "list\n"
+    "bank <id> <file>\n"
+    "emulator <id> <number>\n"
+    "chips <id> <count>\n"
+    "volume <id> <percent>\n"
+    "panic <id>\n"
+    "stats\n";
+
+static bool handle_command(const std::vector<std::string> &args, std::string &reply)
+{
+    const std::string &cmd = args[0];
+    unsigned nargs = args.size() - 1;
+
+    if (cmd == "help") {
+        reply = server_help;
+        return true;
+    }
+
+    if (cmd == "add" && nargs <= 2) {
+        Player_Type pt = ::arg_server_player;
+        unsigned nchip = ::arg_server_nchip;
+        if (nargs >= 1 && (pt = Player::type_by_name(args[1].c_str())) == (Player_Type)-1) {
+            reply = "invalid player";
+            return false;
+        }
+        if (nargs >= 2 && (!parse_unsigned(args[2], nchip) || nchip < 1)) {
+            reply = "invalid chip count";
+            return false;
+        }
+        return add_instance(pt, nchip, reply);
+    }
+
+    if (cmd == "list" && nargs == 0) {
+        for (unsigned i = 0; i < instances_max; ++i) {
+            if (Server_Instance *inst = server_slots[i].load(std::memory_order_relaxed))
+                reply += describe_instance(*inst) + "\n";
+        }
+        return true;
+    }
+
+    if (cmd == "stats" && nargs == 0) {
+        unsigned count = 0;
+        for (unsigned i = 0; i < instances_max; ++i)
+            count += server_slots[i].load(std::memory_order_relaxed) != nullptr;
+        char text[256];
+        snprintf(text, sizeof(text), "instances=%u threads=%u cpu=%.1f%% bank-cache=%zu",
+                 count, server_render_pool->thread_count() + 1,
+                 jack_cpu_load(::server_client), server_bank_cache->size());
+        reply = text;
+        return true;
+    }
+
+    // the commands of an instance
+    unsigned id;
+    Server_Instance *inst;
+    if (nargs < 1 || !parse_unsigned(args[1], id) || !(inst = find_instance(id))) {
+        reply = (nargs < 1) ? "invalid command" : "no such instance";
+        return false;
+    }
+    Synth_Instance &synth = *inst->synth;
+
+    if (cmd == "remove" && nargs == 1)
+        return remove_instance(id, reply);
+
+    if (cmd == "panic" && nargs == 1) {
+        inst->panic_request.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    if (cmd == "volume" && nargs == 2) {
+        unsigned volume;
+        if (!parse_unsigned(args[2], volume)) {
+            reply = "invalid volume";
+            return false;
+        }
+        synth.set_volume(volume);
+        return true;
+    }
+
+    Synth_Instance::Setup setup = synth.setup();
+    if (cmd == "bank" && nargs == 2)
+        setup.bank_file = args[2];
+    else if (cmd == "emulator" && nargs == 2) {
+        if (!parse_unsigned(args[2], setup.emulator)) {
+            reply = "invalid emulator";
+            return false;
+        }
+    }
+    else if (cmd == "chips" && nargs == 2) {
+        if (!parse_unsigned(args[2], setup.chip_count) || setup.chip_count < 1) {
+            reply = "invalid chip count";
+            return false;
+        }
+    }
+    else {
+        reply = "invalid command";
+        return false;
+    }
+
+    std::unique_ptr<Player> player = synth.prepare_player(setup);
+    if (!player) {
+        reply = "cannot set up the player";
+        return false;
+    }
+    if (!offer_player(*inst, std::move(player), reply))
+        return false;
+    synth.commit_setup(setup);
+    return true;
+}
+
+static void handle_server_signals()
+{
+    if (pipe(signal_pipe) == -1)
+        throw std::system_error(errno, std::generic_category(), "pipe");
+    fcntl(signal_pipe[1], F_SETFL, fcntl(signal_pipe[1], F_GETFL) | O_NONBLOCK);
+
+    for (int signo : {SIGINT, SIGTERM}) {
+        struct sigaction sa = {};
+        sa.sa_handler = +[](int) { ssize_t count = write(signal_pipe[1], "", 1); (void)count; };
+        if (sigaction(signo, &sa, nullptr) == -1)
+            throw std::system_error(errno, std::generic_category(), "sigaction");
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: adljack-server [-h] [-p player] [-n chips] [-c count] [-j threads] [-m size] [-s socket]\n"
+            "  -p: the player of the instances added without one (ADLMIDI, OPNMIDI)\n"
+            "  -n: the number of chips of the instances added without one\n"
+            "  -c: the number of instances to add at startup\n"
+            "  -j: the number of render threads, in addition to the audio thread\n"
+            "  -m: the memory budget of the bank cache, in MiB\n"
+            "  -s: the path of the control socket\n"
+            "Commands of the control socket:\n%s", server_help);
+}
+
+int main(int argc, char *argv[])
+{
+    ::arg_threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    ::arg_socket_path = Control_Socket::default_path("adljack-server");
+
+    for (int c; (c = getopt(argc, argv, "hp:n:c:j:m:s:")) != -1;) {
+        unsigned value;
+        switch (c) {
+        case 'p':
+            ::arg_server_player = Player::type_by_name(optarg);
+            if ((int)::arg_server_player == -1) {
+                fprintf(stderr, "Invalid player name.\n");
+                return 1;
+            }
+            break;
+        case 'n':
+            if (!parse_unsigned(optarg, value) || value < 1) {
+                fprintf(stderr, "Invalid number of chips.\n");
+                return 1;
+            }
+            ::arg_server_nchip = value;
+            break;
+        case 'c':
+            if (!parse_unsigned(optarg, value) || value > instances_max) {
+                fprintf(stderr, "Invalid number of instances.\n");
+                return 1;
+            }
+            ::arg_instances = value;
+            break;
+        case 'j':
+            if (!parse_unsigned(optarg, value)) {
+                fprintf(stderr, "Invalid number of threads.\n");
+                return 1;
+            }
+            ::arg_threads = value;
+            break;
+        case 'm':
+            if (!parse_unsigned(optarg, value) || value < 1) {
+                fprintf(stderr, "Invalid memory budget.\n");
+                return 1;
+            }
+            ::arg_server_cache_budget = (size_t)value * 1024 * 1024;
+            break;
+        case 's':
+            ::arg_socket_path = optarg;
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc != optind) {
+        usage();
+        return 1;
+    }
+
+    handle_server_signals();
+
+    Control_Socket control(&handle_command);
+    if (!control.open(::arg_socket_path.c_str())) {
+        fprintf(stderr, "Cannot open the control socket %s: %s\n",
+                ::arg_socket_path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    jack_client_t *client = jack_client_open("ADLjack server", JackNoStartServer, nullptr);
+    if (!client) {
+        fprintf(stderr, "Error creating Jack client.\n");
+        return 1;
+    }
+    ::server_client = client;
+    ::server_sample_rate = jack_get_sample_rate(client);
+    ::server_bank_cache.reset(new Bank_Cache(::arg_server_cache_budget));
+    ::server_render_pool.reset(new Render_Pool(::arg_threads));
+
+    jack_set_process_callback(client, &process, nullptr);
+    if (jack_activate(client) != 0) {
+        fprintf(stderr, "Error activating Jack client.\n");
+        return 1;
+    }
+    if (jack_is_realtime(client))
+        ::server_render_pool->set_priority(jack_client_real_time_priority(client));
+
+    for (unsigned i = 0; i < ::arg_instances; ++i) {
+        std::string reply;
+        if (!add_instance(::arg_server_player, ::arg_server_nchip, reply)) {
+            fprintf(stderr, "Error adding an instance: %s\n", reply.c_str());
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "Jack client \"%s\" fs=%u, %u render threads, control on %s\n",
+            jack_get_client_name(client), ::server_sample_rate,
+            ::arg_threads, control.path().c_str());
+
+    // the replaced players are collected at least every second
+    while (!control.wait(1000, &signal_pipe[0], 1))
+        collect_players();
+
+    fprintf(stderr, "Interrupted.\n");
+    jack_deactivate(client);
+    for (unsigned i = 0; i < instances_max; ++i) {
+        std::unique_ptr<Server_Instance> inst(server_slots[i].exchange(nullptr));
+        if (inst) {
+            delete inst->incoming.load();
+            delete inst->outgoing.load();
+        }
+    }
+    jack_client_close(client);
+    return 0;
+}
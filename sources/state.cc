@@ -7,6 +7,7 @@
 #include "state.h"
 #include "state_generated.h"
 #include "common.h"
+#include "bank_cache.h"
 
 bool save_state(std::vector<uint8_t> &data)
 {
@@ -16,10 +17,13 @@ bool save_state(std::vector<uint8_t> &data)
     using namespace fb::state;
     flatbuffers::FlatBufferBuilder builder(1024);
 
+    Audio_Snapshot snapshot;
+    read_audio_snapshot(snapshot);
+
     std::vector<flatbuffers::Offset<Channel_State>> channel_vector;
     channel_vector.reserve(16);
     for (unsigned i = 0; i < 16; ++i) {
-        const Program &program = ::channel_map[i];
+        const Program &program = snapshot.program[i];
         auto channel = CreateChannel_State(
             builder, program.gm, (program.bank_msb << 7) | program.bank_lsb);
         channel_vector.push_back(channel);
@@ -29,13 +33,14 @@ bool save_state(std::vector<uint8_t> &data)
     player_vector.reserve(player_type_count);
     for (unsigned i = 0; i < player_type_count; ++i) {
         Player_Type pt = (Player_Type)i;
-        Player &pl = *::player[i];
+        // a player not instantiated has no emulator set
+        const char *emulator_name = have_player(pt) ? ::player[i]->emulator_name() : "";
         auto player = CreatePlayer_State(
             builder,
             CreatePlayer_Id(
                 builder,
                 builder.CreateString(Player::name(pt)),
-                builder.CreateString(pl.emulator_name())),
+                builder.CreateString(emulator_name)),
             builder.CreateString(::player_bank_file[i]));
         player_vector.push_back(player);
     }
@@ -47,7 +52,7 @@ bool save_state(std::vector<uint8_t> &data)
         builder,
         builder.CreateVector(channel_vector),
         builder.CreateVector(player_vector),
-        active_player.chip_count(),
+        active_chip_count(),
         ::player_volume,
         CreatePlayer_Id(
             builder,
@@ -93,20 +98,17 @@ bool load_state(const std::vector<uint8_t> &data)
     }
     ::player_volume = volume;
 
+    // the audio side owns the programs, it plays the changes at its next
+    // block. the other players receive them when they take over.
     for (unsigned i = 0; i < 16; ++i) {
         const auto *channel = state->channel()->Get(i);
-        Program program;
-        program.gm = channel->program() & 0x7f;
         unsigned bank = channel->bank();
-        program.bank_lsb = bank & 0x7f;
-        program.bank_msb = (bank >> 7) & 0x7f;
-        for (unsigned pt = 0; pt < player_type_count; ++pt) {
-            Player &pl = *::player[(unsigned)pt];
-            pl.rt_bank_change_msb(i, program.bank_msb);
-            pl.rt_bank_change_lsb(i, program.bank_lsb);
-            pl.rt_program_change(i, program.gm);
-        }
-        ::channel_map[i] = program;
+        const uint8_t msb[] = {(uint8_t)(0xb0 | i), 0, (uint8_t)((bank >> 7) & 0x7f)};
+        const uint8_t lsb[] = {(uint8_t)(0xb0 | i), 32, (uint8_t)(bank & 0x7f)};
+        const uint8_t pgm[] = {(uint8_t)(0xc0 | i), (uint8_t)(channel->program() & 0x7f)};
+        if (!queue_midi(msb, sizeof(msb)) || !queue_midi(lsb, sizeof(lsb)) ||
+            !queue_midi(pgm, sizeof(pgm)))
+            success = false;
     }
 
     for (const auto *player : *state->player()) {
@@ -115,23 +117,32 @@ bool load_state(const std::vector<uint8_t> &data)
             success = false;
             continue;
         }
+        const auto *bank_file = player->bank_file();
+        if (!have_player(pt)) {
+            // loaded on instantiation
+            ::player_bank_file[(unsigned)pt] = bank_file ? bank_file->str() : std::string();
+            continue;
+        }
         Player &pl = *::player[(unsigned)pt];
         if (!pl.set_chip_count(chip_count))
             success = false;
-        const auto *bank_file = player->bank_file();
         if (bank_file && bank_file->size() > 0) {
-            if (!pl.load_bank_file(bank_file->c_str()))
+            std::shared_ptr<const Bank> bank = ::bank_cache->load(pt, bank_file->c_str());
+            if (!bank || !pl.load_bank(bank))
                 success = false;
             else
                 ::player_bank_file[(unsigned)pt] = bank_file->str();
         }
         else {
-            if (!pl.set_embedded_bank(0))
+            if (!load_default_bank(pl))
                 success = false;
             else
                 ::player_bank_file[(unsigned)pt] = std::string();
         }
-        unsigned emu = Player::emulator_by_name(pt, player->id()->emulator()->c_str());
+        const char *emulator_name = player->id()->emulator()->c_str();
+        if (!emulator_name[0])
+            continue;
+        unsigned emu = Player::emulator_by_name(pt, emulator_name);
         if (emu == (unsigned)-1) {
             success = false;
             continue;
@@ -146,10 +157,14 @@ bool load_state(const std::vector<uint8_t> &data)
         active_id.emulator = Player::emulator_by_name(active_id.player, state->active_id()->emulator()->c_str());
 
     auto pos = std::find(::emulator_ids.begin(), ::emulator_ids.end(), active_id);
-    if (pos == ::emulator_ids.end())
+    Player *pl = nullptr;
+    if (pos == ::emulator_ids.end() || !(pl = instantiate_player(active_id.player)))
         success = false;
-    else
+    else {
+        if (!pl->set_emulator(active_id.emulator) || !set_active_chip_count(*pl, chip_count))
+            success = false;
         ::active_emulator_id = std::distance(::emulator_ids.begin(), pos);
+    }
 
     return success;
 }
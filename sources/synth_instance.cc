@@ -0,0 +1,238 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "synth_instance.h"
+#include "bank.h"
+#include "bank_cache.h"
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+static constexpr unsigned synth_event_max = 256;
+
+struct Synth_Instance::Impl {
+    Player_Type player_type;
+    unsigned sample_rate = 0;
+    Bank_Cache *bank_cache = nullptr;
+
+    std::unique_ptr<Player> player;
+    DcFilter dcfilter[2];
+    Channel_Controls channel[16];
+    std::atomic<unsigned> program[16];
+    std::atomic<int> volume{100};
+
+    mutable std::mutex setup_mutex;
+    Setup setup;
+
+    Player::Event events[synth_event_max];
+    unsigned event_count = 0;
+
+    void flush_events();
+    void track_event(const Player::Event &event);
+    void replay_channels(Player &player);
+};
+
+static inline unsigned pack_program(const Program &pgm)
+{
+    return pgm.gm | (pgm.bank_lsb << 7) | (pgm.bank_msb << 14);
+}
+
+static inline Program unpack_program(unsigned packed)
+{
+    Program pgm;
+    pgm.gm = packed & 0x7f;
+    pgm.bank_lsb = (packed >> 7) & 0x7f;
+    pgm.bank_msb = (packed >> 14) & 0x7f;
+    return pgm;
+}
+
+Synth_Instance::Synth_Instance(Player_Type pt, unsigned sample_rate, Bank_Cache &bank_cache)
+    : P(new Impl)
+{
+    P->player_type = pt;
+    P->sample_rate = sample_rate;
+    P->bank_cache = &bank_cache;
+    for (unsigned i = 0; i < 2; ++i)
+        P->dcfilter[i].cutoff(dccutoff / sample_rate);
+    for (unsigned ch = 0; ch < 16; ++ch)
+        P->program[ch].store(0, std::memory_order_relaxed);
+}
+
+Synth_Instance::~Synth_Instance()
+{
+}
+
+Player_Type Synth_Instance::player_type() const
+{
+    return P->player_type;
+}
+
+unsigned Synth_Instance::sample_rate() const
+{
+    return P->sample_rate;
+}
+
+auto Synth_Instance::setup() const -> Setup
+{
+    std::lock_guard<std::mutex> lock(P->setup_mutex);
+    return P->setup;
+}
+
+Program Synth_Instance::program(unsigned channel) const
+{
+    return unpack_program(P->program[channel].load(std::memory_order_relaxed));
+}
+
+void Synth_Instance::set_program(unsigned channel, const Program &pgm)
+{
+    P->program[channel].store(pack_program(pgm), std::memory_order_relaxed);
+}
+
+int Synth_Instance::volume() const
+{
+    return P->volume.load(std::memory_order_relaxed);
+}
+
+void Synth_Instance::set_volume(int volume)
+{
+    volume = std::max(volume_min, std::min(volume_max, volume));
+    P->volume.store(volume, std::memory_order_relaxed);
+}
+
+std::unique_ptr<Player> Synth_Instance::prepare_player(const Setup &setup)
+{
+    Player_Type pt = P->player_type;
+    std::unique_ptr<Player> player(Player::create(pt, P->sample_rate));
+    if (!player)
+        return nullptr;
+    player->set_soft_pan_enabled(true);
+    if (!player->set_emulator(setup.emulator) || !player->set_chip_count(setup.chip_count))
+        return nullptr;
+
+    std::shared_ptr<const Bank> bank;
+    if (!setup.bank_file.empty()) {
+        bank = P->bank_cache->load(pt, setup.bank_file.c_str());
+        if (!bank || !player->load_bank(bank))
+            return nullptr;
+    }
+    else if (!load_default_bank(*player))
+        return nullptr;
+
+    return player;
+}
+
+void Synth_Instance::commit_setup(const Setup &setup)
+{
+    std::lock_guard<std::mutex> lock(P->setup_mutex);
+    P->setup = setup;
+}
+
+std::unique_ptr<Player> Synth_Instance::exchange_player(std::unique_ptr<Player> player)
+{
+    P->flush_events();
+    if (player)
+        P->replay_channels(*player);
+    std::swap(P->player, player);
+    return player;
+}
+
+void Synth_Instance::play_event(const Player::Event &event)
+{
+    if (P->event_count == synth_event_max)
+        P->flush_events();
+    P->events[P->event_count++] = event;
+    P->track_event(event);
+}
+
+void Synth_Instance::render(float *left, float *right, unsigned nframes)
+{
+    Player *player = P->player.get();
+    if (!player) {
+        std::fill(left, left + nframes, 0);
+        std::fill(right, right + nframes, 0);
+        return;
+    }
+
+    P->flush_events();
+    if (nframes == 0)
+        return;
+
+    Player::Audio_Format format;
+    format.type = ADLMIDI_SampleType_F32;
+    format.containerSize = sizeof(float);
+    format.sampleOffset = sizeof(float);
+    player->generate(nframes, left, right, format);
+
+    const double outputgain = P->volume.load(std::memory_order_relaxed) *
+        (1.0 / 100.0) * player->output_gain();
+
+    DcFilter &dclf = P->dcfilter[0];
+    DcFilter &dcrf = P->dcfilter[1];
+    for (unsigned i = 0; i < nframes; ++i) {
+        left[i] = dclf.process(outputgain * left[i]);
+        right[i] = dcrf.process(outputgain * right[i]);
+    }
+}
+
+void Synth_Instance::panic()
+{
+    P->event_count = 0;
+    if (P->player)
+        P->player->panic();
+}
+
+void Synth_Instance::Impl::flush_events()
+{
+    if (event_count == 0)
+        return;
+    if (player)
+        player->rt_events(events, event_count);
+    event_count = 0;
+}
+
+void Synth_Instance::Impl::track_event(const Player::Event &event)
+{
+    Channel_Controls &ctl = channel[event.channel];
+    std::atomic<unsigned> &pgm = program[event.channel];
+
+    switch (event.type) {
+    case Player::Event::Controller: {
+        unsigned cc = event.key;
+        unsigned val = event.value;
+        ctl.controller_change(cc, val);
+        if (cc == 0 || cc == 32) {
+            Program current = unpack_program(pgm.load(std::memory_order_relaxed));
+            ((cc == 0) ? current.bank_msb : current.bank_lsb) = val;
+            pgm.store(pack_program(current), std::memory_order_relaxed);
+        }
+        break;
+    }
+    case Player::Event::Program: {
+        Program current = unpack_program(pgm.load(std::memory_order_relaxed));
+        current.gm = event.value;
+        pgm.store(pack_program(current), std::memory_order_relaxed);
+        break;
+    }
+    case Player::Event::Pitchbend:
+        ctl.pitchbend = event.value;
+        break;
+    case Player::Event::Channel_Aftertouch:
+        ctl.aftertouch = event.value;
+        break;
+    default:
+        break;
+    }
+}
+
+void Synth_Instance::Impl::replay_channels(Player &player)
+{
+    for (unsigned ch = 0; ch < 16; ++ch) {
+        Program pgm = unpack_program(program[ch].load(std::memory_order_relaxed));
+        player.rt_bank_change_msb(ch, pgm.bank_msb);
+        player.rt_bank_change_lsb(ch, pgm.bank_lsb);
+        player.rt_program_change(ch, pgm.gm);
+        channel[ch].replay(player, ch);
+    }
+}
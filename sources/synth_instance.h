@@ -0,0 +1,63 @@
+//          Copyright Jean Pierre Cimalando 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "common.h"
+#include <string>
+#include <memory>
+
+class Bank_Cache;
+
+// A synthesizer with its own player and state of the channels, which does
+// not use the globals of the programs, so that many of them can play in one
+// process. A new setup is applied by preparing a player off the audio
+// thread, which the audio side exchanges with the current one.
+class Synth_Instance {
+public:
+    // what the player is set up with
+    struct Setup {
+        std::string bank_file;  // the embedded bank if empty
+        unsigned emulator = 0;
+        unsigned chip_count = default_nchip;
+    };
+
+    Synth_Instance(Player_Type pt, unsigned sample_rate, Bank_Cache &bank_cache);
+    ~Synth_Instance();
+
+    Player_Type player_type() const;
+    unsigned sample_rate() const;
+    // the setup of the player which was last handed to the audio side
+    Setup setup() const;
+
+    // the programs of the channels, which can be read from any thread
+    Program program(unsigned channel) const;
+    // only while the audio is not running, before exchanging the player
+    void set_program(unsigned channel, const Program &pgm);
+
+    int volume() const;
+    void set_volume(int volume);
+
+    // off the audio thread, create a player with the setup
+    std::unique_ptr<Player> prepare_player(const Setup &setup);
+    // make the setup the current one, once its player is handed to the
+    // audio side
+    void commit_setup(const Setup &setup);
+
+    // on the audio side, take over a prepared player, after bringing it to
+    // the state of the channels. the notes which were playing are cut.
+    // the old player is returned, to be deleted off the audio thread.
+    std::unique_ptr<Player> exchange_player(std::unique_ptr<Player> player);
+
+    // on the audio side, queue an event for the next call to render
+    void play_event(const Player::Event &event);
+    // on the audio side, dispatch the queued events, and render the frames
+    // with the gain and the DC filter applied
+    void render(float *left, float *right, unsigned nframes);
+    void panic();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> P;
+};
@@ -7,6 +7,9 @@
 #include "tui.h"
 #include "tui_channels.h"
 #include "tui_fileselect.h"
+#include "bank_watch.h"
+#include "bank_loader.h"
+#include "bank_cache.h"
 #include "insnames.h"
 #include "i18n.h"
 #include "common.h"
@@ -14,9 +17,10 @@
 #include <cmath>
 #include <limits.h>
 #include <assert.h>
-#include <sys/stat.h>
-#include <sys/types.h>
 #include <unistd.h>
+#if !defined(PDCURSES) && !defined(_WIN32)
+#include <poll.h>
+#endif
 #if defined(PDCURSES)
 #include <SDL.h>
 #endif
@@ -41,29 +45,55 @@ struct TUI_windows
     WINDOW_u keydesc2;
 };
 
+// the contents last drawn into each widget, for redrawing only what changes
+struct TUI_display
+{
+    bool valid = false;
+    std::string title;
+    const Player *player = nullptr;
+    unsigned emulator = 0;
+    unsigned chip_count = 0;
+    int cpu_level = 0;
+    std::string bank_file;
+    int volume = 0;
+    int volume_level[2] = {};
+    struct Instrument {
+        unsigned gm = 0;
+        bool playing = false;
+        const char *name = nullptr;
+        Midi_Spec spec = Midi_Spec::GM;
+    };
+    Instrument instrument[16];
+    bool status = false;
+};
+
 struct TUI_context
 {
     bool quit = false;
     TUI_windows win;
+    TUI_display display;
     std::string status_text;
     bool status_display = false;
     unsigned status_timeout = 0;
     stc::steady_clock::time_point status_start;
     Player *player = nullptr;
     std::string bank_directory;
-    time_t bank_mtime[player_type_count] = {};
+    Bank_Watcher bank_watcher;
+    Bank_Loader bank_loader;
+    bool bank_reload_pending = false;
+    stc::steady_clock::time_point bank_reload_time;
     static constexpr unsigned perc_display_interval = 10;
     unsigned perc_display_cycle = 0;
     bool have_perc_display_program = false;
     Midi_Program_Ex perc_display_program;
-    struct Channel_State {
-        std::unique_ptr<char[]> data;
-        unsigned size = 0;
-        unsigned serial = 0;
-    };
-    Channel_State channel_state;
+    // the state of the audio, read at every redraw
+    Audio_Snapshot snapshot;
+    // the position in the notifications, and the last description of the voices
+    Notification_Bus::Cursor notification_cursor;
+    Notification_Value channels;
     void (*idle_proc)(void *) = nullptr;
     void *idle_data = nullptr;
+    int idle_fd = -1;
 };
 
 #if defined(PDCURSES)
@@ -76,9 +106,18 @@ static void show_status(TUI_context &ctx, std::string text, unsigned timeout = 1
 static bool handle_anylevel_key(TUI_context &ctx, int key);
 static bool handle_toplevel_key(TUI_context &ctx, int key);
 static void handle_notifications(TUI_context &ctx);
-static bool update_bank_mtime(TUI_context &ctx);
-
-void curses_interface_exec(void (*idle_proc)(void *), void *idle_data)
+static void handle_bank_changes(TUI_context &ctx, stc::steady_clock::time_point &deadline);
+static void wait_for_events(TUI_context &ctx, stc::steady_clock::time_point deadline);
+static int next_key(TUI_context &ctx);
+
+// wait interval when some task must be polled
+static constexpr stc::milliseconds poll_interval(50);
+// interval of bank modification checks, when not notified
+static constexpr stc::seconds bank_check_interval(1);
+// delay before reloading a bank, which lets the writer finish
+static constexpr stc::milliseconds bank_reload_delay(250);
+
+void curses_interface_exec(void (*idle_proc)(void *), void *idle_data, int idle_fd)
 {
     Screen screen;
     screen.init();
@@ -86,6 +125,8 @@ void curses_interface_exec(void (*idle_proc)(void *), void *idle_data)
     TUI_context ctx;
     ctx.idle_proc = idle_proc;
     ctx.idle_data = idle_data;
+    ctx.idle_fd = idle_fd;
+    ctx.notification_cursor = ::notification_bus.subscribe();
 #if defined(PDCURSES)
     install_event_hook(ctx);
 #endif
@@ -95,8 +136,7 @@ void curses_interface_exec(void (*idle_proc)(void *), void *idle_data)
     raw();
     keypad(stdscr, true);
     noecho();
-    const unsigned timeout_ms = 50;
-    timeout(timeout_ms);
+    timeout(0);
     curs_set(0);
 #if !defined(PDCURSES)
     set_escdelay(25);
@@ -115,8 +155,8 @@ void curses_interface_exec(void (*idle_proc)(void *), void *idle_data)
     setup_display(ctx);
     show_status(ctx, _("Ready!"));
 
-    unsigned bank_check_interval = 1;
-    stc::steady_clock::time_point bank_check_last = stc::steady_clock::now();
+    const stc::nanoseconds frame_interval(1000000000 / ::arg_ui_fps);
+    stc::steady_clock::time_point frame_last;
 
     while (!ctx.quit && !interface_interrupted()) {
         if (idle_proc)
@@ -124,29 +164,38 @@ void curses_interface_exec(void (*idle_proc)(void *), void *idle_data)
 
         handle_notifications(ctx);
 
+        finish_player_switch();
         Player *player = have_active_player() ? &active_player() : nullptr;
-        if (ctx.player != player) {
-            ctx.player = player;
-            update_bank_mtime(ctx);
-        }
+        ctx.player = player;
 
         stc::steady_clock::time_point now = stc::steady_clock::now();
-        if (now - bank_check_last > stc::seconds(bank_check_interval)) {
-            if (update_bank_mtime(ctx)) {
-                if (ctx.player->dynamic_load_bank(active_bank_file().c_str()))
-                    show_status(ctx, _("Bank has changed on disk. Reload!"));
-                else
-                    show_status(ctx, _("Bank has changed on disk. Reloading failed."));
-            }
-            bank_check_last = now;
+        stc::steady_clock::time_point deadline = stc::steady_clock::time_point::max();
+
+        handle_bank_changes(ctx, deadline);
+        release_inactive_players(deadline);
+        scale_chip_count(deadline);
+        govern_cpu_load(deadline);
+
+        // redraw, no faster than the frame rate
+        if (now - frame_last >= frame_interval) {
+            update_display(ctx);
+            doupdate();
+            frame_last = now;
         }
+        else
+            deadline = std::min(deadline, frame_last + frame_interval);
+
+        if (ctx.status_display)
+            deadline = std::min(deadline, ctx.status_start + stc::seconds(ctx.status_timeout + 1));
+        if (idle_proc && idle_fd == -1)
+            deadline = std::min(deadline, now + poll_interval);
 
-        update_display(ctx);
+        wait_for_events(ctx, deadline);
 
-        int key = getch();
-        if (!handle_anylevel_key(ctx, key))
-            handle_toplevel_key(ctx, key);
-        doupdate();
+        for (int key; !ctx.quit && (key = getch()) != ERR;) {
+            if (!handle_anylevel_key(ctx, key))
+                handle_toplevel_key(ctx, key);
+        }
     }
     ctx.win = TUI_windows();
     screen.end();
@@ -226,6 +275,7 @@ static void setup_colors()
 static void setup_display(TUI_context &ctx)
 {
     ctx.win = TUI_windows();
+    ctx.display = TUI_display();
 
     bkgd(COLOR_PAIR(Colors_Background));
 
@@ -266,9 +316,17 @@ static void setup_display(TUI_context &ctx)
     ctx.win.keydesc2.reset(derwin_s(inner, 1, cols, rows - 1, 0));
 }
 
+static int bar_level(int size, double vol)
+{
+    int cells = size - 2;
+    if (cells <= 0 || !(vol > 0))
+        return 0;
+    return (int)std::min<double>(cells, std::ceil(vol * cells));
+}
+
 static int print_bar(
     WINDOW *w, int y, int x, int size,
-    double vol, char ch_on, char ch_off, int attr_on)
+    int level, char ch_on, char ch_off, int attr_on)
 {
     if (size < 2)
         return ERR;
@@ -276,8 +334,7 @@ static int print_bar(
         return ERR;
     waddch(w, '[');
     for (int i = 0; i < size - 2; ++i) {
-        double ref = (double)i / (size - 2);
-        bool gt = vol > ref;
+        bool gt = i < level;
         if (gt) wattron(w, attr_on);
         waddch(w, gt ? ch_on : ch_off);
         if (gt) wattroff(w, attr_on);
@@ -289,92 +346,124 @@ static int print_bar(
 static void update_display(TUI_context &ctx)
 {
     Player *player = ctx.player;
+    TUI_display &disp = ctx.display;
+
+    // redraw everything after the windows are recreated or the screen erased
+    bool redraw = !disp.valid;
+    disp.valid = true;
+
+    bool player_changed = redraw || disp.player != player;
+    disp.player = player;
+
+    const Audio_Snapshot &snap = ctx.snapshot;
+    read_audio_snapshot(ctx.snapshot);
 
     if (WINDOW *w = ctx.win.outer.get()) {
         std::string title = get_program_title();
-        size_t titlesize = title.size();
-
-        wattron(w, A_BOLD|COLOR_PAIR(Colors_Frame));
-        wborder(w, ' ', ' ', '-', '-', '-', '-', '-', '-');
-        wattroff(w, A_BOLD|COLOR_PAIR(Colors_Frame));
+        if (redraw || disp.title != title) {
+            size_t titlesize = title.size();
 
-        unsigned cols = getcols(stdscr);
-        if (cols >= titlesize + 2) {
-            unsigned x = (cols - (titlesize + 2)) / 2;
             wattron(w, A_BOLD|COLOR_PAIR(Colors_Frame));
-            mvwaddch(w, 0, x, '(');
-            mvwaddch(w, 0, x + titlesize + 1, ')');
+            wborder(w, ' ', ' ', '-', '-', '-', '-', '-', '-');
             wattroff(w, A_BOLD|COLOR_PAIR(Colors_Frame));
-            mvwaddstr(w, 0, x + 1, title.c_str());
+
+            unsigned cols = getcols(stdscr);
+            if (cols >= titlesize + 2) {
+                unsigned x = (cols - (titlesize + 2)) / 2;
+                wattron(w, A_BOLD|COLOR_PAIR(Colors_Frame));
+                mvwaddch(w, 0, x, '(');
+                mvwaddch(w, 0, x + titlesize + 1, ')');
+                wattroff(w, A_BOLD|COLOR_PAIR(Colors_Frame));
+                mvwaddstr(w, 0, x + 1, title.c_str());
+            }
+            wnoutrefresh(w);
+            disp.title = std::move(title);
         }
-        wnoutrefresh(w);
     }
 
     if (WINDOW *w = ctx.win.playertitle.get()) {
-        mvwaddstr(w, 0, 0, _("Player"));
-        if (player) {
-            wattron(w, COLOR_PAIR(Colors_Highlight));
-            mvwprintw(w, 0, 15, "%s %s", player->name(), player->version());
-            wattroff(w, COLOR_PAIR(Colors_Highlight));
+        if (player_changed) {
+            mvwaddstr(w, 0, 0, _("Player"));
+            if (player) {
+                wattron(w, COLOR_PAIR(Colors_Highlight));
+                mvwprintw(w, 0, 15, "%s %s", player->name(), player->version());
+                wattroff(w, COLOR_PAIR(Colors_Highlight));
+            }
+            wclrtoeol(w);
+            wnoutrefresh(w);
         }
-        wclrtoeol(w);
-        wnoutrefresh(w);
     }
     if (WINDOW *w = ctx.win.emutitle.get()) {
-        mvwaddstr(w, 0, 0, _("Emulator"));
-        if (player) {
-            wattron(w, COLOR_PAIR(Colors_Highlight));
-            mvwaddstr(w, 0, 15, player->emulator_name());
-            wattroff(w, COLOR_PAIR(Colors_Highlight));
+        unsigned emulator = player ? player->emulator() : 0;
+        if (player_changed || disp.emulator != emulator) {
+            mvwaddstr(w, 0, 0, _("Emulator"));
+            if (player) {
+                wattron(w, COLOR_PAIR(Colors_Highlight));
+                mvwaddstr(w, 0, 15, player->emulator_name());
+                wattroff(w, COLOR_PAIR(Colors_Highlight));
+            }
+            wclrtoeol(w);
+            wnoutrefresh(w);
+            disp.emulator = emulator;
         }
-        wclrtoeol(w);
-        wnoutrefresh(w);
     }
     if (WINDOW *w = ctx.win.chipcount.get()) {
-        mvwaddstr(w, 0, 0, _("Chips"));
-        if (player) {
-            wattron(w, COLOR_PAIR(Colors_Highlight));
-            mvwprintw(w, 0, 15, "%u", player->chip_count());
-            wattroff(w, COLOR_PAIR(Colors_Highlight));
-            waddstr(w, " * ");
-            wattron(w, COLOR_PAIR(Colors_Highlight));
-            waddstr(w, player->chip_name());
-            wattroff(w, COLOR_PAIR(Colors_Highlight));
+        unsigned chip_count = player ? active_chip_count() : 0;
+        if (player_changed || disp.chip_count != chip_count) {
+            mvwaddstr(w, 0, 0, _("Chips"));
+            if (player) {
+                wattron(w, COLOR_PAIR(Colors_Highlight));
+                mvwprintw(w, 0, 15, "%u", chip_count);
+                wattroff(w, COLOR_PAIR(Colors_Highlight));
+                waddstr(w, " * ");
+                wattron(w, COLOR_PAIR(Colors_Highlight));
+                waddstr(w, player->chip_name());
+                wattroff(w, COLOR_PAIR(Colors_Highlight));
+            }
+            wclrtoeol(w);
+            wnoutrefresh(w);
+            disp.chip_count = chip_count;
         }
-        wclrtoeol(w);
-        wnoutrefresh(w);
     }
     if (WINDOW *w = ctx.win.cpuratio.get()) {
-        mvwaddstr(w, 0, 0, _("CPU"));
-        print_bar(w, 0, 15, 15, cpuratio, '*', '-', COLOR_PAIR(Colors_Highlight));
-        wclrtoeol(w);
-        wnoutrefresh(w);
+        const int size = 15;
+        int level = bar_level(size, snap.cpuratio);
+        if (redraw || disp.cpu_level != level) {
+            mvwaddstr(w, 0, 0, _("CPU"));
+            print_bar(w, 0, 15, size, level, '*', '-', COLOR_PAIR(Colors_Highlight));
+            wclrtoeol(w);
+            wnoutrefresh(w);
+            disp.cpu_level = level;
+        }
     }
     if (WINDOW *w = ctx.win.banktitle.get()) {
-        mvwaddstr(w, 0, 0, _("Bank"));
-        if (player) {
-            std::string title;
-            const std::string &path = active_bank_file();
-            if (path.empty())
-                title = _("(default)");
-            else
-            {
+        const std::string *path = player ? &active_bank_file() : nullptr;
+        if (player_changed || (path && disp.bank_file != *path)) {
+            mvwaddstr(w, 0, 0, _("Bank"));
+            if (path) {
+                std::string title;
+                if (path->empty())
+                    title = _("(default)");
+                else
+                {
 #if !defined(_WIN32)
-                size_t pos = path.rfind('/');
+                    size_t pos = path->rfind('/');
 #else
-                size_t pos = path.find_last_of("/\\");
+                    size_t pos = path->find_last_of("/\\");
 #endif
-                title = (pos != path.npos) ? path.substr(pos + 1) : path;
+                    title = (pos != path->npos) ? path->substr(pos + 1) : *path;
+                }
+                wattron(w, COLOR_PAIR(Colors_Highlight));
+                mvwaddstr(w, 0, 15, title.c_str());
+                wattroff(w, COLOR_PAIR(Colors_Highlight));
+                disp.bank_file = *path;
             }
-            wattron(w, COLOR_PAIR(Colors_Highlight));
-            mvwaddstr(w, 0, 15, title.c_str());
-            wattroff(w, COLOR_PAIR(Colors_Highlight));
+            wclrtoeol(w);
+            wnoutrefresh(w);
         }
-        wclrtoeol(w);
-        wnoutrefresh(w);
     }
 
-    double channel_volumes[2] = {lvcurrent[0], lvcurrent[1]};
+    double channel_volumes[2] = {snap.lvcurrent[0], snap.lvcurrent[1]};
     const char *channel_names[2] = {_("Left"), _("Right")};
 
     // enables logarithmic view for perceptual volume, otherwise linear.
@@ -382,12 +471,16 @@ static void update_display(TUI_context &ctx)
     const bool logarithmic = false;
 
     if (WINDOW *w = ctx.win.volumeratio.get()) {
-        mvwaddstr(w, 0, 0, _("Volume"));
-        wattron(w, COLOR_PAIR(Colors_Highlight));
-        mvwprintw(w, 0, 15, "%3d%%\n", ::player_volume);
-        wattroff(w, COLOR_PAIR(Colors_Highlight));
-        wclrtoeol(w);
-        wrefresh(w);
+        int volume = ::player_volume;
+        if (redraw || disp.volume != volume) {
+            mvwaddstr(w, 0, 0, _("Volume"));
+            wattron(w, COLOR_PAIR(Colors_Highlight));
+            mvwprintw(w, 0, 15, "%3d%%\n", volume);
+            wattroff(w, COLOR_PAIR(Colors_Highlight));
+            wclrtoeol(w);
+            wnoutrefresh(w);
+            disp.volume = volume;
+        }
     }
 
     for (unsigned channel = 0; channel < 2; ++channel) {
@@ -401,43 +494,32 @@ static void update_display(TUI_context &ctx)
             vol = (db - dbmin) / (0 - dbmin);
         }
 
+        int size = getcols(w) - 7;
+        int level = bar_level(size, vol);
+        if (!redraw && disp.volume_level[channel] == level)
+            continue;
+
         mvwaddstr(w, 0, 0, channel_names[channel]);
-        print_bar(w, 0, 7, getcols(w) - 7, vol, '*', '-', A_BOLD|COLOR_PAIR(Colors_ActiveVolume));
+        print_bar(w, 0, 7, size, level, '*', '-', A_BOLD|COLOR_PAIR(Colors_ActiveVolume));
         wclrtoeol(w);
         wnoutrefresh(w);
+        disp.volume_level[channel] = level;
     }
 
     for (unsigned midichannel = 0; midichannel < 16; ++midichannel) {
         WINDOW *w = ctx.win.instrument[midichannel].get();
         if (!w) continue;
-        const Program &pgm = channel_map[midichannel];
-        mvwprintw(w, 0, 0, "%2u: [", midichannel + 1);
-        wattron(w, A_BOLD|COLOR_PAIR(Colors_ProgramNumber));
-        wprintw(w, "%3u", pgm.gm);
-        wattroff(w, A_BOLD|COLOR_PAIR(Colors_ProgramNumber));
-        waddstr(w, "]");
-
-        bool playing = midi_channel_note_count[midichannel] > 0;
-        wattron(w, A_BOLD|COLOR_PAIR(Colors_ActiveVolume));
-        mvwaddch(w, 0, 11, playing ? '*' : ' ');
-        wattroff(w, A_BOLD|COLOR_PAIR(Colors_ActiveVolume));
+        const Program &pgm = snap.program[midichannel];
+        bool playing = snap.note_count[midichannel] > 0;
 
         const char *name = nullptr;
         Midi_Spec spec = Midi_Spec::GM;
 
-        const int ms_attr[5] = {
-            A_BOLD|COLOR_PAIR(Colors_Instrument),
-            A_BOLD|COLOR_PAIR(Colors_InstrumentEx),
-            A_BOLD|COLOR_PAIR(Colors_InstrumentEx),
-            A_BOLD|COLOR_PAIR(Colors_InstrumentEx),
-            A_BOLD|COLOR_PAIR(Colors_InstrumentEx),
-        };
-
         if (midichannel == 9) {
             // percussion display, with update rate limit
             if (++ctx.perc_display_cycle == ctx.perc_display_interval) {
                 ctx.perc_display_cycle = 0;
-                if (unsigned pgm = ::midi_channel_last_note_p1[midichannel]) {
+                if (unsigned pgm = snap.last_note_p1[midichannel]) {
                     --pgm;
                     ctx.have_perc_display_program = true;
                     ctx.perc_display_program = midi_db.perc(pgm);
@@ -463,6 +545,33 @@ static void update_display(TUI_context &ctx)
                 name = midi_db.inst(pgm.gm);
         }
 
+        TUI_display::Instrument &last = disp.instrument[midichannel];
+        if (!redraw && last.gm == pgm.gm && last.playing == playing &&
+            last.name == name && last.spec == spec)
+            continue;
+        last.gm = pgm.gm;
+        last.playing = playing;
+        last.name = name;
+        last.spec = spec;
+
+        mvwprintw(w, 0, 0, "%2u: [", midichannel + 1);
+        wattron(w, A_BOLD|COLOR_PAIR(Colors_ProgramNumber));
+        wprintw(w, "%3u", pgm.gm);
+        wattroff(w, A_BOLD|COLOR_PAIR(Colors_ProgramNumber));
+        waddstr(w, "]");
+
+        wattron(w, A_BOLD|COLOR_PAIR(Colors_ActiveVolume));
+        mvwaddch(w, 0, 11, playing ? '*' : ' ');
+        wattroff(w, A_BOLD|COLOR_PAIR(Colors_ActiveVolume));
+
+        const int ms_attr[5] = {
+            A_BOLD|COLOR_PAIR(Colors_Instrument),
+            A_BOLD|COLOR_PAIR(Colors_InstrumentEx),
+            A_BOLD|COLOR_PAIR(Colors_InstrumentEx),
+            A_BOLD|COLOR_PAIR(Colors_InstrumentEx),
+            A_BOLD|COLOR_PAIR(Colors_InstrumentEx),
+        };
+
         int attr = ms_attr[(unsigned)spec];
         wattron(w, attr);
         mvwaddstr(w, 0, 12, name);
@@ -470,19 +579,15 @@ static void update_display(TUI_context &ctx)
         if (spec != Midi_Spec::GM)
             wprintw(w, " [%s]", midi_spec_name(spec));
         wclrtoeol(w);
-        wrefresh(w);
+        wnoutrefresh(w);
     }
 
     if (WINDOW *w = ctx.win.status.get()) {
         if (!ctx.status_text.empty()) {
             if (!ctx.status_display) {
-                wattron(w, COLOR_PAIR(Colors_Select));
-                mvwaddstr(w, 0, 0, ctx.status_text.c_str());
-                wattroff(w, COLOR_PAIR(Colors_Select));
                 ctx.status_start = stc::steady_clock::now();
                 ctx.status_display = true;
-                wclrtoeol(w);
-                wnoutrefresh(w);
+                disp.status = false;
             }
             else if (stc::steady_clock::now() - ctx.status_start > stc::seconds(ctx.status_timeout)) {
                 ctx.status_text.clear();
@@ -490,9 +595,21 @@ static void update_display(TUI_context &ctx)
                 werase(w);
                 wnoutrefresh(w);
             }
+            if (ctx.status_display && (redraw || !disp.status)) {
+                wattron(w, COLOR_PAIR(Colors_Select));
+                mvwaddstr(w, 0, 0, ctx.status_text.c_str());
+                wattroff(w, COLOR_PAIR(Colors_Select));
+                wclrtoeol(w);
+                wnoutrefresh(w);
+                disp.status = true;
+            }
         }
     }
 
+    // the rest is static, draw it once
+    if (!redraw)
+        return;
+
     struct Key_Description {
         Key_Description(const char *key, const char *desc)
             : key(key), desc(desc) {}
@@ -593,14 +710,14 @@ static bool handle_toplevel_key(TUI_context &ctx, int key)
         return true;
     }
     case '[': {
-        unsigned nchips = player->chip_count();
+        unsigned nchips = active_chip_count();
         if (nchips > 1)
-            player->dynamic_set_chip_count(nchips - 1);
+            dynamic_switch_chip_count(nchips - 1);
         return true;
     }
     case ']': {
-        unsigned nchips = player->chip_count();
-        player->dynamic_set_chip_count(nchips + 1);
+        unsigned nchips = active_chip_count();
+        dynamic_switch_chip_count(nchips + 1);
         return true;
     }
     case '/': {
@@ -627,8 +744,8 @@ static bool handle_toplevel_key(TUI_context &ctx, int key)
         void (*idle_proc)(void *) = ctx.idle_proc;
         void *idle_data = ctx.idle_data;
 
-        for (key = getch(); !ctx.quit && !interface_interrupted() &&
-                 code == File_Selection_Code::Continue; key = getch()) {
+        for (key = next_key(ctx); !ctx.quit && !interface_interrupted() &&
+                 code == File_Selection_Code::Continue; key = next_key(ctx)) {
             if (idle_proc)
                 idle_proc(idle_data);
 
@@ -648,10 +765,10 @@ static bool handle_toplevel_key(TUI_context &ctx, int key)
         }
 
         if (code == File_Selection_Code::Ok) {
-            if (player->dynamic_load_bank(fopts.filepath.c_str())) {
+            std::shared_ptr<const Bank> bank = ::bank_cache->load(player->type(), fopts.filepath.c_str());
+            if (bank && dynamic_update_bank(*player, bank)) {
                 show_status(ctx, _("Bank loaded!"));
                 active_bank_file() = fopts.filepath;
-                update_bank_mtime(ctx);
             }
             else
                 show_status(ctx, _("Error loading the bank file."));
@@ -659,6 +776,7 @@ static bool handle_toplevel_key(TUI_context &ctx, int key)
         }
 
         erase();
+        ctx.display.valid = false;
         return true;
     }
     case 'p':
@@ -675,15 +793,19 @@ static bool handle_toplevel_key(TUI_context &ctx, int key)
         Channel_Monitor cm;
         cm.setup_display(w.get());
 
-        TUI_context::Channel_State &state = ctx.channel_state;
-        cm.update(state.data.get(), state.size, state.serial);
+        Notification_Bus &bus = ::notification_bus;
+        Notification_Bus::Cursor &cursor = ctx.notification_cursor;
+        Notification_Value &channels = ctx.channels;
+        bus.get(cursor, Notify_Channels, channels);
+        cm.update((char *)channels.data, channels.size, cursor.slot[Notify_Channels]);
+        set_channel_description(true);
 
         void (*idle_proc)(void *) = ctx.idle_proc;
         void *idle_data = ctx.idle_data;
 
         int code = 1;
-        for (key = getch(); !ctx.quit && !interface_interrupted() &&
-                 code > 0; key = getch()) {
+        for (key = next_key(ctx); !ctx.quit && !interface_interrupted() &&
+                 code > 0; key = next_key(ctx)) {
             if (idle_proc)
                 idle_proc(idle_data);
 
@@ -697,12 +819,15 @@ static bool handle_toplevel_key(TUI_context &ctx, int key)
             }
             else {
                 code = cm.key(key);
-                cm.update(state.data.get(), state.size, state.serial);
+                if (bus.get(cursor, Notify_Channels, channels))
+                    cm.update((char *)channels.data, channels.size, cursor.slot[Notify_Channels]);
             }
             doupdate();
         }
 
+        set_channel_description(false);
         erase();
+        ctx.display.valid = false;
         return true;
     }
     }
@@ -710,49 +835,139 @@ static bool handle_toplevel_key(TUI_context &ctx, int key)
 
 static void handle_notifications(TUI_context &ctx)
 {
-    Ring_Buffer *fifo = ::fifo_notify.get();
-    if (!fifo)
-        return;
+    Notification_Bus &bus = ::notification_bus;
+    Notification_Event event;
 
-    Notify_Header hdr;
-    while (fifo->peek(hdr) && fifo->size_used() >= sizeof(hdr) + hdr.size) {
-        fifo->discard(sizeof(hdr));
-        switch (hdr.type) {
+    while (bus.next(ctx.notification_cursor, event)) {
+        switch (event.type) {
         default:
             assert(false);
             break;
-        case Notify_TextInsert: {
-            std::unique_ptr<char[]> buf(new char[hdr.size]);
-            fifo->get(buf.get(), hdr.size);
-            show_status(ctx, std::string(buf.get(), hdr.size));
+        case Notify_TextInsert:
+            show_status(ctx, std::string((const char *)event.data, event.size));
             break;
         }
-        case Notify_Channels: {
-            assert((hdr.size & 1) == 0);
-            TUI_context::Channel_State &state = ctx.channel_state;
-            if (state.size < hdr.size)
-                state.data.reset(new char[hdr.size]);
-            fifo->get(state.data.get(), hdr.size);
-            state.size = hdr.size;
-            ++state.serial;
-            break;
+    }
+}
+
+static void handle_bank_changes(TUI_context &ctx, stc::steady_clock::time_point &deadline)
+{
+    Player *player = ctx.player;
+    Bank_Watcher &watcher = ctx.bank_watcher;
+    Bank_Loader &loader = ctx.bank_loader;
+
+    // receive the banks which finished loading
+    Bank_Load_Result res;
+    while (loader.result(res)) {
+        if (res.path != ::player_bank_file[(unsigned)res.type] || !have_player(res.type))
+            continue;  // not current anymore
+        Player &pl = *::player[(unsigned)res.type];
+        Bank_Update update;
+        if (res.success && dynamic_update_bank(pl, res.bank, &update)) {
+            if (!update.incremental)
+                show_status(ctx, _("Bank has changed on disk. Reload!"));
+            else {
+                char buf[128];
+                snprintf(buf, sizeof(buf), _("Bank has changed on disk. Updated %u instruments."), update.instruments);
+                show_status(ctx, buf);
+            }
         }
+        else
+            show_status(ctx, _("Bank has changed on disk. Reloading failed."));
+    }
+
+    // follow the bank of the active player
+    const std::string &path = player ? active_bank_file() : std::string();
+    if (watcher.path() != path) {
+        watcher.watch(path);
+        ctx.bank_reload_pending = false;
+    }
+    if (path.empty())
+        return;
+
+    stc::steady_clock::time_point now = stc::steady_clock::now();
+
+    if (watcher.fd() != -1) {
+        if (watcher.check()) {
+            // debounce the successive events of a write
+            ctx.bank_reload_pending = true;
+            ctx.bank_reload_time = now + bank_reload_delay;
         }
     }
+    else if (!ctx.bank_reload_pending) {
+        if (now - ctx.bank_reload_time >= bank_check_interval) {
+            if (watcher.check())
+                ctx.bank_reload_pending = true;
+            else
+                ctx.bank_reload_time = now;
+        }
+        if (!ctx.bank_reload_pending) {
+            deadline = std::min(deadline, ctx.bank_reload_time + bank_check_interval);
+            return;
+        }
+    }
+
+    if (ctx.bank_reload_pending) {
+        if (now >= ctx.bank_reload_time) {
+            loader.request(player->type(), path);
+            ctx.bank_reload_pending = false;
+        }
+        else
+            deadline = std::min(deadline, ctx.bank_reload_time);
+    }
 }
 
-static bool update_bank_mtime(TUI_context &ctx)
+static void wait_for_events(TUI_context &ctx, stc::steady_clock::time_point deadline)
 {
-    Player *player = ctx.player;
-    if (!player)
-        return false;
-    struct stat st;
-    const char *path = active_bank_file().c_str();
-    Player_Type pt = player->type();
-    time_t old_mtime = ctx.bank_mtime[(unsigned)pt];
-    time_t new_mtime = (path[0] && !stat(path, &st)) ? st.st_mtime : 0;
-    ctx.bank_mtime[(unsigned)pt] = new_mtime;
-    return new_mtime && new_mtime != old_mtime;
+    int timeout_ms = -1;
+    if (deadline != stc::steady_clock::time_point::max()) {
+        stc::steady_clock::time_point now = stc::steady_clock::now();
+        stc::milliseconds remain = (deadline > now) ?
+            stc::duration_cast<stc::milliseconds>(deadline - now) + stc::milliseconds(1) :
+            stc::milliseconds(0);
+        timeout_ms = (int)std::min<stc::milliseconds::rep>(remain.count(), INT_MAX);
+    }
+
+#if !defined(PDCURSES) && !defined(_WIN32)
+    pollfd pfd[4] = {};
+    unsigned npfd = 0;
+    for (int fd : {STDIN_FILENO, interface_wakeup_fd(), ctx.idle_fd, ctx.bank_watcher.fd()}) {
+        if (fd == -1)
+            continue;
+        pfd[npfd].fd = fd;
+        pfd[npfd].events = POLLIN;
+        ++npfd;
+    }
+
+    if (poll(pfd, npfd, timeout_ms) > 0) {
+        for (unsigned i = 0; i < npfd; ++i) {
+            if ((pfd[i].revents & POLLIN) && pfd[i].fd == interface_wakeup_fd())
+                acknowledge_interface_wakeup();
+        }
+    }
+#else
+    // no descriptor to wait on, poll the keyboard with a timeout
+    if (timeout_ms < 0 || timeout_ms > poll_interval.count())
+        timeout_ms = poll_interval.count();
+    timeout(timeout_ms);
+    int key = getch();
+    timeout(0);
+    if (key != ERR)
+        ungetch(key);
+#endif
+}
+
+static int next_key(TUI_context &ctx)
+{
+    int key = getch();
+    if (key == ERR) {
+        stc::steady_clock::time_point deadline = stc::steady_clock::time_point::max();
+        if (ctx.idle_proc && ctx.idle_fd == -1)
+            deadline = stc::steady_clock::now() + poll_interval;
+        wait_for_events(ctx, deadline);
+        key = getch();
+    }
+    return key;
 }
 
 //------------------------------------------------------------------------------
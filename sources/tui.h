@@ -23,7 +23,7 @@ enum {
     Colors_MidiCh16 = Colors_MidiCh1 + 15,
 };
 
-void curses_interface_exec(void (*idle_proc)(void *), void *idle_data);
+void curses_interface_exec(void (*idle_proc)(void *), void *idle_data, int idle_fd);
 
 //------------------------------------------------------------------------------
 struct Screen {
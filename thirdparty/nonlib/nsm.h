@@ -277,6 +277,15 @@ nsm_check_nowait (nsm_client_t *nsm )
     nsm_check_wait( nsm, 0 );
 }
 
+/* added for adljack: the descriptor of the server, which an event loop
+ * waits on before calling nsm_check_nowait() */
+NSM_EXPORT
+int
+nsm_get_socket_fd ( nsm_client_t *nsm )
+{
+    return lo_server_get_socket_fd( _NSM()->_server );
+}
+
 
 NSM_EXPORT
 void
@@ -0,0 +1,8 @@
+# Conversion from binary to C, as a list of byte initializers.
+# Usage: cmake -DINPUT=file.bin -DOUTPUT=file.h -P bin2c.cmake
+
+file(READ "${INPUT}" hex HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)" "\\1\n" bytes "${bytes}")
+get_filename_component(name "${INPUT}" NAME)
+file(WRITE "${OUTPUT}" "// BEGIN \"${name}\"\n${bytes}\n// END \"${name}\"\n")